@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+"""Measures how many integers per second IN =KBD reads through each input path.
+
+    python3 programs/benchmark_input.py ./ttkc --count 10000000
+
+Writes that many random numbers to a temporary file, then runs
+programs/sum_input.k91 on them: memory mapped with --input=<file>, piped in with
+--input=-, and through the interactive prompt (std::cin) with stdin redirected.
+The sum each run prints is checked against the expected one.
+"""
+
+import argparse
+import os
+import random
+import re
+import subprocess
+import sys
+import tempfile
+
+PROGRAM = os.path.join(os.path.dirname(os.path.abspath(__file__)), "sum_input.k91")
+
+UNITS = {"ns": 1e-9, "us": 1e-6, "ms": 1e-3, "s": 1.0}
+
+
+def run(ttkc, args, stdin):
+    result = subprocess.run([ttkc, PROGRAM, *args], stdin=stdin, stdout=subprocess.PIPE, text=True)
+    match = re.search(r"Execution finished in ([0-9.]+)(ns|us|ms|s)\.", result.stdout)
+    if result.returncode != 0 or not match:
+        sys.exit(f"ttkc failed:\n{result.stdout}")
+    numbers = [line.strip("> ") for line in result.stdout.splitlines()]
+    sums = [int(n) for n in numbers if re.fullmatch(r"-?[0-9]+", n)]
+    return sums[-1] if sums else None, float(match.group(1)) * UNITS[match.group(2)]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("ttkc", help="path to the ttkc executable")
+    parser.add_argument("--count", type=int, default=1_000_000, help="numbers to read (default: 1000000)")
+    parser.add_argument("--no-cin", action="store_true", help="skip the slow std::cin path")
+    args = parser.parse_args()
+
+    rng = random.Random(91)
+    values = [rng.randint(-1_000_000, 1_000_000) for _ in range(args.count)]
+    expected = sum(values)
+    expected = (expected + 2**31) % 2**32 - 2**31  # the sum wraps around like ADD does
+
+    with tempfile.NamedTemporaryFile("w", suffix=".txt", delete=False) as f:
+        f.write(f"{args.count}\n")
+        f.write("\n".join(map(str, values)))
+        f.write("\n")
+        path = f.name
+
+    try:
+        paths = [
+            ("--input=<file> (mmap)", ["--input=" + path], None),
+            ("--input=- (pipe)", ["--input=-"], "pipe"),
+        ]
+        if not args.no_cin:
+            paths.append(("std::cin", [], "file"))
+
+        for name, ttkc_args, stdin in paths:
+            with open(path, "rb") as f:
+                if stdin == "pipe":
+                    cat = subprocess.Popen(["cat", path], stdout=subprocess.PIPE)
+                    total, seconds = run(args.ttkc, ttkc_args, cat.stdout)
+                    cat.wait()
+                else:
+                    total, seconds = run(args.ttkc, ttkc_args, f if stdin else subprocess.DEVNULL)
+            status = "ok" if total == expected else f"WRONG SUM {total}, expected {expected}"
+            rate = (args.count + 1) / seconds / 1e6
+            print(f"{name:<24}{seconds * 1e3:10.1f} ms {rate:10.2f} million integers/s   {status}")
+    finally:
+        os.unlink(path)
+
+
+if __name__ == "__main__":
+    main()
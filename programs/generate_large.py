@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+"""Generates a large TTK91 program for stress testing the compiler and the interpreter
+with more than 32K instructions, the way machine-generated code tends to look.
+
+    python3 programs/generate_large.py > large.k91
+    ttkc large.k91 -i=10
+
+The program is a long chain of small blocks with branches, far forward jumps and
+calls to subroutines at both ends of the code, run for a number of rounds. The
+checksum it prints is worked out here as well and noted at the top of the file.
+"""
+
+import argparse
+
+MASK = 32767
+
+
+def generate(num_blocks, rounds):
+    lines = []
+    emit = lines.append
+
+    # Instruction count excluding the compiler's HALT, to report the size
+    count = 0
+
+    def ins(label, text):
+        nonlocal count
+        count += 1
+        emit(f"{label:<10}{text}")
+
+    # Simulated alongside, so the expected output can be written down
+    state = 1
+
+    def low_sub(x):  # LowSub
+        return (x * 3 + 1) & MASK
+
+    def high_sub(x):  # HighSub
+        return (x ^ 1234) & MASK
+
+    body = []  # (block, kind, parameters), the same for every round
+
+    for i in range(num_blocks):
+        add = (i * 37) % 1000 + 1
+        mul = 3 + i % 7
+        threshold = (i * 7919) % MASK
+        xor = (i * 131) & 255
+        if i % 997 == 0 and i + 1 < num_blocks:
+            far = min(num_blocks - 1, i + 1 + (i * 7919) % 5000)
+        else:
+            far = None
+        call = "LowSub" if i % 499 == 0 else "HighSub" if i % 503 == 0 else None
+        body.append((add, mul, threshold, xor, far, call))
+
+    def run_round(x):
+        i = 0
+        while i < num_blocks:
+            add, mul, threshold, xor, far, call = body[i]
+            x = ((x + add) * mul) & MASK
+            if x <= threshold:
+                x ^= xor
+            if call == "LowSub":
+                x = low_sub(x)
+            elif call == "HighSub":
+                x = high_sub(x)
+            if far is not None and x > MASK // 2:
+                i = far
+                continue
+            i += 1
+        return x
+
+    for _ in range(rounds):
+        state = run_round(state)
+
+    emit("; Generated by programs/generate_large.py, don't edit by hand")
+    emit(f"; Expected output: {state}")
+    emit("")
+    emit(f"Rounds    DC {rounds}")
+    emit("")
+    ins("", "LOAD R1, =1")
+    ins("", "LOAD R2, =0        ; rounds done")
+    ins("", "JUMP B0")
+    emit("")
+    ins("LowSub", "MUL R1, =3")
+    ins("", "ADD R1, =1")
+    ins("", f"AND R1, ={MASK}")
+    ins("", "EXIT SP, =0")
+    emit("")
+
+    for i, (add, mul, threshold, xor, far, call) in enumerate(body):
+        ins(f"B{i}", f"ADD R1, ={add}")
+        ins("", f"MUL R1, ={mul}")
+        ins("", f"AND R1, ={MASK}")
+        ins("", f"COMP R1, ={threshold}")
+        ins("", f"JGRE S{i}")
+        ins("", f"XOR R1, ={xor}")
+        ins(f"S{i}", "NOP")
+        if call is not None:
+            ins("", f"CALL {call}")
+        if far is not None:
+            ins("", f"COMP R1, ={MASK // 2}")
+            ins("", f"JGRE B{far}")
+
+    emit("")
+    ins("", "ADD R2, =1")
+    ins("", "COMP R2, Rounds")
+    ins("", "JLES B0")
+    ins("", "OUT R1, =CRT")
+    ins("", "SVC SP, =HALT")
+    emit("")
+    ins("HighSub", "XOR R1, =1234")
+    ins("", f"AND R1, ={MASK}")
+    ins("", "EXIT SP, =0")
+
+    lines.insert(2, f"; {count} instructions, {num_blocks} blocks, {rounds} rounds")
+    return "\n".join(lines) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--blocks", type=int, default=143000, help="about 7 instructions each (default: 143000)")
+    parser.add_argument("--rounds", type=int, default=10, help="times the whole chain runs (default: 10)")
+    args = parser.parse_args()
+    print(generate(args.blocks, args.rounds), end="")
+
+
+if __name__ == "__main__":
+    main()
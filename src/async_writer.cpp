@@ -0,0 +1,71 @@
+#include "async_writer.hpp"
+#include "devices.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+// Values formatted before handing their slots back, so a full ring gets going again quickly
+static constexpr u64 BATCH = 4096;
+
+AsyncWriter::AsyncWriter() : ring(CAPACITY) {
+    thread = std::thread([this] { run(); });
+}
+
+AsyncWriter::~AsyncWriter() {
+    stop.store(true, std::memory_order_release);
+    thread.join();
+}
+
+void AsyncWriter::wait_for_space(u64 h) {
+    while (true) {
+        cached_tail = tail.load(std::memory_order_acquire);
+        if (h - cached_tail < CAPACITY) return;
+        std::this_thread::yield();
+    }
+}
+
+void AsyncWriter::drain() {
+    u64 h = head.load(std::memory_order_relaxed);
+    while (written.load(std::memory_order_acquire) < h) {
+        std::this_thread::yield();
+    }
+}
+
+void AsyncWriter::run() {
+    char text[1 << 16];
+    u32 size = 0;
+    u32 idle = 0;
+
+    while (true) {
+        u64 t = tail.load(std::memory_order_relaxed);
+        u64 h = head.load(std::memory_order_acquire);
+
+        if (t == h) {
+            // Caught up: get everything out, so that drain() can return
+            if (size != 0 || written.load(std::memory_order_relaxed) != t) {
+                std::fwrite(text, 1, size, stdout);
+                std::fflush(stdout);
+                size = 0;
+                written.store(t, std::memory_order_release);
+            }
+            if (stop.load(std::memory_order_acquire) && head.load(std::memory_order_acquire) == t) return;
+
+            // Nothing to do, back off gradually
+            if (++idle < 64) std::this_thread::yield();
+            else std::this_thread::sleep_for(std::chrono::microseconds(50));
+            continue;
+        }
+        idle = 0;
+
+        for (u64 batch_end = std::min(h, t + BATCH); t != batch_end; ++t) {
+            if (size > sizeof(text) - MAX_OUTPUT_TEXT) {
+                std::fwrite(text, 1, size, stdout);
+                size = 0;
+            }
+            const Entry &entry = ring[t & (CAPACITY - 1)];
+            size = u32(format_output(text + size, entry.value, entry.device) - text);
+        }
+        tail.store(t, std::memory_order_release);
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "types.hpp"
+
+// Prints the numbers OUT produces on a thread of its own, for --async-output. The
+// interpreter only drops each value into a single-producer single-consumer ring buffer.
+// Formatting them and the write() calls happen on the writer thread, so a slow pipe on
+// stdout doesn't hold up execution until the ring fills up.
+class AsyncWriter {
+public:
+    AsyncWriter();
+    ~AsyncWriter(); // writes out whatever is left
+
+    AsyncWriter(const AsyncWriter &) = delete;
+    AsyncWriter &operator=(const AsyncWriter &) = delete;
+
+    // `device` is one of OutDevices
+    void push(i32 value, i32 device) {
+        u64 h = head.load(std::memory_order_relaxed);
+        if (h - cached_tail == CAPACITY) wait_for_space(h);
+        ring[h & (CAPACITY - 1)] = { value, device };
+        head.store(h + 1, std::memory_order_release);
+    }
+
+    // Returns once everything pushed so far is on stdout. Anything else printed to stdout
+    // has to come after this to keep the order right.
+    void drain();
+
+private:
+    static constexpr u64 CAPACITY = 1 << 16; // power of two
+
+    void wait_for_space(u64 h);
+    void run();
+
+    struct Entry {
+        i32 value;
+        i32 device;
+    };
+    std::vector<Entry> ring;
+
+    // Only the producer touches these two
+    u64 cached_tail = 0;
+    alignas(64) std::atomic<u64> head{0};
+
+    alignas(64) std::atomic<u64> tail{0};    // values taken out of the ring
+    alignas(64) std::atomic<u64> written{0}; // values flushed to stdout
+    std::atomic<bool> stop{false};
+
+    std::thread thread;
+};
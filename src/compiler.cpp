@@ -1,11 +1,15 @@
 #include "compiler.hpp"
 
 #include <iostream>
+#include <fstream>
 #include <iomanip>
 #include <cstring>
 #include <charconv>
 #include <cstdarg>
 #include <algorithm>
+#include <utility>
+#include <memory_resource>
+#include <cstdint>
 
 #include "tsl/robin_map.h"
 
@@ -59,8 +63,56 @@ static bool pop_word(std::string_view &str, std::string_view &out) {
     return true;
 }
 
-static std::vector<std::string_view> to_lines(std::string_view str) {
-    auto lines = std::vector<std::string_view>{};
+// Variables must be declared before code, but that is not possible for jumps.
+// Because of this, the jump address for jumps to the future need to be
+// resolved in a second pass. 
+// Instruction index tells which instruction in the "instructions" vector needs resolving.
+struct UnresolvedJump {
+    std::string_view label_name; // points into CompilerCtx::source
+    u32 instruction_idx;
+};
+
+// Jumps to a number can only be checked once the length of the program is known
+struct NumericJump {
+    std::string_view target; // points into CompilerCtx::source
+    i32 address;
+    std::size_t line_num;
+    const char *line_start;
+};
+
+// Counts the blocks the compiler arena gets from the heap, for --stats
+class CountingResource : public std::pmr::memory_resource {
+public:
+    u64 num_allocations = 0;
+    u64 num_bytes = 0;
+
+private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        num_allocations += 1;
+        num_bytes += bytes;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) override {
+        std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+};
+
+// Everything that only lives during compilation comes out of one arena and goes away with it.
+// Nothing is freed individually, so allocating is a pointer bump.
+template <typename T>
+using ArenaVector = std::pmr::vector<T>;
+
+template <typename T>
+using ArenaTable = tsl::robin_map<std::string_view, T, std::hash<std::string_view>, std::equal_to<std::string_view>,
+    std::pmr::polymorphic_allocator<std::pair<std::string_view, T>>>;
+
+static void to_lines(std::string_view str, ArenaVector<std::string_view> &lines) {
+    lines.reserve(std::size_t(std::count(str.begin(), str.end(), '\n')) + 1);
 
     while (!str.empty()) {
         std::string_view line{};
@@ -82,46 +134,55 @@ static std::vector<std::string_view> to_lines(std::string_view str) {
 
         lines.push_back(line);
     }
-
-    return lines;
 }
 
-// Variables must be declared before code, but that is not possible for jumps.
-// Because of this, the jump address for jumps to the future need to be
-// resolved in a second pass. 
-// Instruction index tells which instruction in the "instructions" vector needs resolving.
-struct UnresolvedJump {
-    std::string label_name;
-    u32 instruction_idx;
-};
-
 // All pseudocommands get a value in the table:
 // - Labels get an address (to jump to)
 // - DC/DS get an address (to where the data is)
 // - EQUs get a value
+// Keys point into CompilerCtx::source
 struct SymbolTable {
-    tsl::robin_map<std::string, i32> symbols;
-    tsl::robin_map<std::string, i16> labels;
-    std::vector<DataConstant> values;
-    i32 total_num_bytes;
+    explicit SymbolTable(std::pmr::memory_resource *arena)
+        : symbols(arena), labels(arena), values(arena), scalar_addresses(arena) {}
+
+    ArenaTable<i32> symbols;
+    ArenaTable<i32> labels; // past 32767, jumps need wide operands
+    ArenaVector<DataConstant> values;
+    ArenaVector<i32> scalar_addresses; // single-word DC/DS variables
+    i32 total_num_bytes = 0; // actually words with --compact-data
+    i32 bytes_per_word = 4; // how far DC/DS move the next address per word, 1 or 4
 };
 
 struct Logging {
-    u32 num_errors;
-    u32 num_warnings;
+    explicit Logging(std::pmr::memory_resource *arena)
+        : lines(arena), instr_to_line_table(arena) {}
 
-    std::size_t current_line_num;
-    const char *current_line_start; // pointer to first (lowercase) char in current line
+    u32 num_errors = 0;
+    u32 num_warnings = 0;
+
+    std::size_t current_line_num = 0;
+    const char *current_line_start = nullptr; // pointer to first (lowercase) char in current line
     std::string_view file_name;
-    std::vector<std::string_view> lines;
+    ArenaVector<std::string_view> lines;
 
-    std::vector<u32> instr_to_line_table; // instruction index -> line index mapping
+    ArenaVector<u32> instr_to_line_table; // instruction index -> line index mapping
 };
 
 struct CompilerCtx {
+    explicit CompilerCtx(std::pmr::memory_resource *arena)
+        : sym_table(arena), instructions(arena), operands(arena), unresolved_jumps(arena), numeric_jumps(arena),
+          logging(arena) {}
+
+    // Lowercased copy of the whole source in the arena. Every name the compiler keeps is a view
+    // into it, so identifiers never get copied and all of them are freed together.
+    std::string_view source;
+
     SymbolTable sym_table;
-    std::vector<u32> instructions;
-    std::vector<UnresolvedJump> unresolved_jumps;
+    ArenaVector<u32> instructions;
+    ArenaVector<i32> operands; // full value of each instruction, see Program::wide_operands
+    bool wide_operands = false;
+    ArenaVector<UnresolvedJump> unresolved_jumps;
+    ArenaVector<NumericJump> numeric_jumps;
     Logging logging;
 };
 
@@ -220,8 +281,10 @@ private:
 
 namespace InstructionParserFns {
     namespace Detail {
-        static void add_instruction(CompilerCtx &ctx, InstructionType type, Register dst, Register src, AddressMode addrm, i16 offset) {
-            if (type != InstructionType::STORE && src == Register::R0) {
+        static void add_instruction(CompilerCtx &ctx, InstructionType type, Register dst, Register src, AddressMode addrm, i32 value) {
+            // R0 as a base register reads as zero. POP is the exception: its "source"
+            // is the register being popped into.
+            if (type != InstructionType::POP && src == Register::R0) {
                 src = Register::EXT_ZR;
             }
          
@@ -230,11 +293,15 @@ namespace InstructionParserFns {
                 | encode_dst(dst)
                 | encode_src(src)
                 | encode_addrm(addrm)
-                | encode_value(offset)
+                | encode_value(i16(value))
             );
+
+            // Values that don't fit in the instruction make the whole program use wide operands
+            ctx.operands.push_back(value);
+            if (value != i16(value)) ctx.wide_operands = true;
         }
 
-        static void add_instruction(CompilerCtx &ctx, InstructionType type, Register reg, i16 value) {
+        static void add_instruction(CompilerCtx &ctx, InstructionType type, Register reg, i32 value) {
             add_instruction(ctx, type, reg, Register::R0, AddressMode::IMMEDIATE, value);
         }
 
@@ -242,10 +309,10 @@ namespace InstructionParserFns {
             add_instruction(ctx, type, reg, Register::R0, AddressMode::IMMEDIATE, 0);
         }
 
-        static bool resolve_symbol(std::string_view str, CompilerCtx &ctx, i16 &out) {
+        static bool resolve_symbol(std::string_view str, CompilerCtx &ctx, i32 &out) {
             auto &table = ctx.sym_table.symbols;
         
-            if (auto it = table.find(std::string{ str }); it != table.end()) {
+            if (auto it = table.find(str); it != table.end()) {
                 out = it->second;
                 return true;
             }
@@ -366,7 +433,7 @@ namespace InstructionParserFns {
         // Should only be called if at least the first character is a digit
         // Also note: not a general-purpose function, this is used specifically to
         // parse an index or an immediate value in the second operand.
-        static bool parse_address_or_immediate(CompilerCtx &ctx, std::string_view &str_in_out, i16 &out) {
+        static bool parse_address_or_immediate(CompilerCtx &ctx, std::string_view &str_in_out, i32 &out) {
             // First find the length, and check that there are no unexpected characters.
             // Should end in whitespace or a (.
             std::size_t length = 0;
@@ -386,7 +453,7 @@ namespace InstructionParserFns {
                 Message::error(ctx)
                     .underline_start(std::size_t(str_in_out.data() - ctx.logging.current_line_start))
                     .underline_len(length)
-                    .printf("Error: Integer value out of range (should be between -32,768 and 32,767)", 
+                    .printf("Error: Integer value out of range (should be between -2,147,483,648 and 2,147,483,647)", 
                         (int)length, str_in_out.data());
                 return false;
             }
@@ -406,10 +473,10 @@ namespace InstructionParserFns {
 
         // Parse source register, addressing mode and address all at once,
         // because they are inherently related.
-        static bool parse_src_address_mode(std::string_view str, CompilerCtx &ctx, Register &src_out, AddressMode &addr_mode_out, i16 &addr_out) {
+        static bool parse_src_address_mode(std::string_view str, CompilerCtx &ctx, Register &src_out, AddressMode &addr_mode_out, i32 &addr_out) {
             AddressMode addr_mode{};
             Register src{};
-            i16 address{};
+            i32 address{};
 
             skip_spaces(str);
 
@@ -526,7 +593,7 @@ namespace InstructionParserFns {
             
             Register src{};
             AddressMode addr_mode{};
-            i16 address{};
+            i32 address{};
             if (!parse_src_address_mode(src_unparsed, ctx, src, addr_mode, address)) {
                 return;
             }
@@ -542,9 +609,9 @@ namespace InstructionParserFns {
             add_instruction(ctx, type, dst, src, addr_mode, address);            
         }
 
-        static bool try_resolve_label(std::string_view name, CompilerCtx &ctx, i16 &address_out) {
+        static bool try_resolve_label(std::string_view name, CompilerCtx &ctx, i32 &address_out) {
            auto &label_table = ctx.sym_table.labels;
-            if (auto it = label_table.find(std::string{ name }); it != label_table.end()) {
+            if (auto it = label_table.find(name); it != label_table.end()) {
                 address_out = it->second;
                 return true;
             }
@@ -552,7 +619,8 @@ namespace InstructionParserFns {
         }
 
         static void make_jump_instr(InstructionType type, std::string_view param, Register opt_reg, CompilerCtx &ctx) {
-            i16 address{};
+            std::string_view target = param; // parsing consumes `param`
+            i32 address{};
             if (try_resolve_label(param, ctx, address)) {
                 return add_instruction(ctx, type, opt_reg, address);
             }
@@ -560,11 +628,19 @@ namespace InstructionParserFns {
             if (!is_integer(param)) {
                 // Delayed resolve
                 ctx.unresolved_jumps.push_back(UnresolvedJump {
-                    .label_name = std::string{param},
+                    .label_name = param,
                     .instruction_idx = u32(ctx.instructions.size()),
                 });
             } else if (!parse_address_or_immediate(ctx, param, address)) {
                 return; // error messages in parse_address_or_immediate
+            } else {
+                // Range checked in check_jump_addresses()
+                ctx.numeric_jumps.push_back(NumericJump {
+                    .target = target,
+                    .address = address,
+                    .line_num = ctx.logging.current_line_num,
+                    .line_start = ctx.logging.current_line_start,
+                });
             }
 
             if (address < 0) {
@@ -626,7 +702,7 @@ namespace InstructionParserFns {
 
             Register ignored{};
             AddressMode mode{};
-            i16 address{};
+            i32 address{};
             if (!parse_src_address_mode(val_str, ctx, ignored, mode, address)) {
                 return;
             }
@@ -679,15 +755,23 @@ namespace InstructionParserFns {
                 return;
             }
 
-            if (dst_str != "=kbd") { // Change this when more devices are added
+            // The EXT_ ones are extensions, see InDevices
+            static constexpr std::pair<std::string_view, InDevices> DEVICES[] = {
+                { "=kbd", InDevices::KBD },
+                { "=fkbd", InDevices::EXT_FKBD },
+                { "=ckbd", InDevices::EXT_CKBD },
+                { "=ckbd_nio", InDevices::EXT_CKBD_NIO },
+            };
+            auto device = std::find_if(std::begin(DEVICES), std::end(DEVICES), [&](const auto &d) { return d.first == dst_str; });
+            if (device == std::end(DEVICES)) {
                 Message::error(ctx)
                     .underline_code(dst_str)
                     .printf("Error: Unrecognized device for IN: '%.*s'", (int)dst_str.length(), dst_str.data())
-                    .extra("Error: Valid ones are: =KBD");
+                    .extra("Error: Valid ones are: =KBD (and extensions =FKBD, =CKBD, =CKBD_NIO)");
                 return;
             }
 
-            add_instruction(ctx, InstructionType::IN, reg, i16(InDevices::KBD));
+            add_instruction(ctx, InstructionType::IN, reg, i16(device->second));
         }
 
         static void parse_out(InstructionType, std::string_view line, CompilerCtx &ctx) {
@@ -702,15 +786,22 @@ namespace InstructionParserFns {
                 return;
             }
 
-            if (dst_str != "=crt") { // Change this when more devices are added
+            // The EXT_ ones are extensions, see OutDevices
+            static constexpr std::pair<std::string_view, OutDevices> DEVICES[] = {
+                { "=crt", OutDevices::CRT },
+                { "=fcrt", OutDevices::EXT_FCRT },
+                { "=ccrt", OutDevices::EXT_CCRT },
+            };
+            auto device = std::find_if(std::begin(DEVICES), std::end(DEVICES), [&](const auto &d) { return d.first == dst_str; });
+            if (device == std::end(DEVICES)) {
                 Message::error(ctx)
                     .underline_code(dst_str)
                     .printf("Error: Unrecognized device for OUT: '%.*s'", (int)dst_str.length(), dst_str.data())
-                    .extra("Error: Valid ones are: =CRT");
+                    .extra("Error: Valid ones are: =CRT (and extensions =FCRT, =CCRT)");
                 return;
             }
 
-            add_instruction(ctx, InstructionType::OUT, reg, i16(OutDevices::CRT));
+            add_instruction(ctx, InstructionType::OUT, reg, i16(device->second));
         }
 
         static void parse_push(InstructionType type, std::string_view line, CompilerCtx &ctx) {
@@ -735,7 +826,7 @@ namespace InstructionParserFns {
 
             Register src{};
             AddressMode mode{};
-            i16 address{};
+            i32 address{};
             if (!parse_src_address_mode(dst_str, ctx, src, mode, address)) {
                 return;
             }
@@ -794,7 +885,7 @@ namespace InstructionParserFns {
             
             Register dst{};
             AddressMode addr_mode{};
-            i16 address{};
+            i32 address{};
             if (!parse_src_address_mode(dst_unparsed, ctx, dst, addr_mode, address)) {
                 return;
             }
@@ -948,8 +1039,9 @@ static bool parse_pseudoinstruction(CompilerCtx &ctx, std::string_view line) {
     if (type_str == "dc") {
         i32 temp = value;
         value = ctx.sym_table.total_num_bytes;
-        ctx.sym_table.total_num_bytes += 4;
+        ctx.sym_table.total_num_bytes += ctx.sym_table.bytes_per_word;
         ctx.sym_table.values.push_back(DataConstant{.address = value, .value = temp });
+        ctx.sym_table.scalar_addresses.push_back(value);
     } else if (type_str == "ds") {
         if (value < 0) {
             Message::error(ctx)
@@ -960,10 +1052,11 @@ static bool parse_pseudoinstruction(CompilerCtx &ctx, std::string_view line) {
 
         i32 temp = value;
         value = ctx.sym_table.total_num_bytes;
-        ctx.sym_table.total_num_bytes += 4 * temp;
+        ctx.sym_table.total_num_bytes += ctx.sym_table.bytes_per_word * temp;
+        if (temp == 1) ctx.sym_table.scalar_addresses.push_back(value);
     }
 
-    if (!ctx.sym_table.symbols.try_emplace(std::string{ name }, value).second) {
+    if (!ctx.sym_table.symbols.try_emplace(name, value).second) {
         Message::error(ctx)
             .underline_code(name)
             .printf("Error: Symbol with the name '%.*s' already exists.\n",
@@ -997,7 +1090,7 @@ static void parse_line(std::string_view line, CompilerCtx &ctx, ParserTable &par
             }
         }
 
-        if (!ctx.sym_table.labels.try_emplace(std::string{ word }, i16(ctx.instructions.size())).second) {
+        if (!ctx.sym_table.labels.try_emplace(word, i32(ctx.instructions.size())).second) {
             Message::error(ctx)
                 .underline_code(word)
                 .printf("Error: Duplicate label '%.*s'\n", (int)word.length(), word.data());
@@ -1034,7 +1127,9 @@ static void resolve_jumps(CompilerCtx &ctx) {
         
         if (auto it = labels.find(entry.label_name); it != labels.end()) {
             instruction &= ~encode_value(i16((1 << VALUE_BITS) - 1));
-            instruction |= encode_value(it->second);
+            instruction |= encode_value(i16(it->second));
+            ctx.operands[entry.instruction_idx] = it->second;
+            if (it->second > INT16_MAX) ctx.wide_operands = true;
         } else {
             auto &label = entry.label_name;
             std::printf("Error: Label '%.*s' not found\n", (int) label.length(), label.data());
@@ -1044,19 +1139,56 @@ static void resolve_jumps(CompilerCtx &ctx) {
     ctx.unresolved_jumps.clear();
 }
 
-static std::string_view lowercase(std::string_view str, std::string &buf) {
-    if (str.empty()) return str;
-    
+static void check_jump_addresses(CompilerCtx &ctx) {
+    // The HALT added at the end can be jumped to as well
+    i32 last = i32(ctx.instructions.size());
+    for (auto jump : ctx.numeric_jumps) {
+        if (jump.address <= last) continue;
+
+        ctx.logging.current_line_num = jump.line_num;
+        ctx.logging.current_line_start = jump.line_start;
+        Message::error(ctx)
+            .underline_code(jump.target)
+            .printf("Error: Jump address out of range (should be at most %d)", last);
+    }
+    ctx.numeric_jumps.clear();
+}
+
+static std::string_view lowercase(std::string_view str, std::pmr::memory_resource &arena) {
+    char *buf = static_cast<char *>(arena.allocate(str.length(), alignof(char)));
     for (std::size_t i = 0; i < str.length(); ++i) {
         buf[i] = std::tolower(str[i]);
     }
-    buf[str.length()] = '\0';
 
-    return substring(buf, 0, str.length());
+    return std::string_view{ buf, str.length() };
 }
 
-bool Compiler::compile(std::string_view file_name, std::string source_code, Program &out) {
-    auto ctx = CompilerCtx {};
+bool Compiler::read_source(const char *file_name, std::string &out) {
+    std::ifstream stream(file_name, std::ios::in | std::ios::binary);
+    if (stream) {
+        stream.seekg(0, std::ios::end);
+        out.clear();
+        out.resize(std::size_t(stream.tellg()) + 1);
+        stream.seekg(0, std::ios::beg);
+        stream.read(reinterpret_cast<char*>(&out[0]), out.size()-1);
+        stream.close();
+
+        out[out.size()-1] = '\n';
+        return true;
+    }
+    return false;
+}
+
+bool Compiler::compile(std::string_view file_name, std::string source_code, Program &out, const Options &options) {
+    // Room for the lowercased source, the lines and roughly what the tables and bytecode of a
+    // typical program take, so that most compiles get by with the first block
+    auto num_lines = std::size_t(std::count(source_code.begin(), source_code.end(), '\n')) + 1;
+    auto heap = CountingResource{};
+    auto arena = std::pmr::monotonic_buffer_resource{
+        2 * source_code.size() + num_lines * (sizeof(std::string_view) + sizeof(u32)) + 4096, &heap };
+
+    auto ctx = CompilerCtx{ &arena };
+    ctx.source = lowercase(source_code, arena);
     auto &parsers = InstructionParserFns::table();
 
     // Address 0 is unfortunately reserved for R0 with the system in place,
@@ -1064,22 +1196,22 @@ bool Compiler::compile(std::string_view file_name, std::string source_code, Prog
     // such that they start from address 1, leaving address 0 for R0.
     ctx.sym_table.total_num_bytes = 1;
 
-    ctx.logging = Logging {
-        .num_errors = 0,
-        .current_line_num = 0,
-        .current_line_start = nullptr, // initialized below
-        .file_name = file_name,
-        .lines = to_lines(source_code),
-        .instr_to_line_table = std::vector<u32>{}
-    };
+    // Memory is made of i32s, so spacing variables 4 apart leaves 3 of every 4 words unused.
+    // Kept as the default since programs may (however unwisely) depend on the gaps.
+    ctx.sym_table.bytes_per_word = options.compact_data ? 1 : 4;
+
+    ctx.logging.file_name = file_name;
+    to_lines(source_code, ctx.logging.lines);
     auto &lines = ctx.logging.lines;
+    ctx.logging.instr_to_line_table.reserve(lines.size());
+    ctx.instructions.reserve(lines.size() + 1); // at most one per line, and the HALT at the end
+    ctx.operands.reserve(lines.size() + 1);
 
     // Pseudoinstructions must be at the top, parse them first
-    std::string buffer{};
-    buffer.resize(64, '\0');
-
     for (std::size_t i = 0; i < lines.size(); ++i) {
-        std::string_view line = lowercase(lines[i], buffer);
+        // Same line in the lowercased copy
+        std::size_t offset = std::size_t(lines[i].data() - source_code.data());
+        std::string_view line = substring(ctx.source, offset, offset + lines[i].length());
         if (line.empty()) continue;
 
         ctx.logging.current_line_num = i;
@@ -1091,6 +1223,7 @@ bool Compiler::compile(std::string_view file_name, std::string source_code, Prog
     }
 
     resolve_jumps(ctx);
+    check_jump_addresses(ctx);
 
     auto errors = ctx.logging.num_errors;
     if (errors > 0) {
@@ -1106,12 +1239,22 @@ bool Compiler::compile(std::string_view file_name, std::string source_code, Prog
     // make sure the program actually terminates. And then nag about it :)
     InstructionParserFns::Detail::add_instruction(ctx, InstructionType::EXT_HALT, Register::SP);
 
-    out.instructions = ctx.instructions;
-    out.constants = ctx.sym_table.values;
+    if (options.stats) {
+        std::printf("Compiler: %llu KiB in %llu arena block%s\n",
+            heap.num_bytes >> 10, heap.num_allocations, heap.num_allocations == 1 ? "" : "s");
+    }
+
+    out.instructions.assign(ctx.instructions.begin(), ctx.instructions.end());
+    out.wide_operands.clear();
+    if (ctx.wide_operands) {
+        out.wide_operands.assign(ctx.operands.begin(), ctx.operands.end());
+    }
+    out.constants.assign(ctx.sym_table.values.begin(), ctx.sym_table.values.end());
+    out.scalar_addresses.assign(ctx.sym_table.scalar_addresses.begin(), ctx.sym_table.scalar_addresses.end());
     out.data_section_bytes = ctx.sym_table.total_num_bytes;
-    out.source_code = std::move(source_code);
-    out.source_code_lines = std::move(ctx.logging.lines);
-    out.instr_idx_to_line_idx = std::move(ctx.logging.instr_to_line_table);
+    out.source_file = std::string{ file_name };
+    out.source_hash = hash_bytes(HASH_SEED, source_code.data(), source_code.size());
+    out.instr_idx_to_line_idx.assign(ctx.logging.instr_to_line_table.begin(), ctx.logging.instr_to_line_table.end());
 
     return true;
 }
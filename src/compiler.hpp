@@ -5,7 +5,11 @@
 
 #include "instructions.hpp"
 #include "program.hpp"
+#include "options.hpp"
 
 namespace Compiler {
-    bool compile(std::string_view file_name, std::string textual_code, Program &out);
+    // Reads a source file the way compile() expects it
+    bool read_source(const char *file_name, std::string &out);
+
+    bool compile(std::string_view file_name, std::string textual_code, Program &out, const Options &options);
 }
\ No newline at end of file
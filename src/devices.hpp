@@ -0,0 +1,32 @@
+#pragma once
+
+#include <bit>
+#include <charconv>
+
+#include "types.hpp"
+#include "instructions.hpp"
+
+// What the output devices print, shared by everything that turns OUT values into text.
+//   CRT       the value as an integer, one per line
+//   EXT_FCRT  the value's bits as a float, one per line
+//   EXT_CCRT  the lowest 8 bits as a single byte, nothing else
+
+// Room format_output() needs, enough for "-2147483648\n" and floats like "-1.17549435e-38\n"
+constexpr u32 MAX_OUTPUT_TEXT = 32;
+
+inline char *format_output(char *out, i32 value, i32 device) {
+    if (device == i32(OutDevices::CRT)) [[likely]] {
+        out = std::to_chars(out, out + MAX_OUTPUT_TEXT, value).ptr;
+        *out++ = '\n';
+        return out;
+    }
+
+    if (device == i32(OutDevices::EXT_CCRT)) {
+        *out++ = char(value);
+        return out;
+    }
+
+    out = std::to_chars(out, out + MAX_OUTPUT_TEXT - 1, std::bit_cast<f32>(value)).ptr;
+    *out++ = '\n';
+    return out;
+}
@@ -0,0 +1,193 @@
+#include "input.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static constexpr std::size_t BUFFER_SIZE = 1 << 16;
+
+// Anything longer isn't a 32-bit number. The buffer is topped up to at least this much
+// before parsing, so that numbers aren't cut in half at the end of it.
+static constexpr std::ptrdiff_t MAX_TOKEN = 64;
+
+// Longest token shown in error messages
+static constexpr std::size_t MAX_SHOWN_TOKEN = 32;
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Length of the run of digits at `p`. Checks 16 bytes at a time where it can, so the
+// end of a number is found without looking at every character separately.
+static std::size_t digit_run(const char *p, const char *end) {
+    const char *start = p;
+#ifdef __SSE2__
+    const __m128i below = _mm_set1_epi8('0' - 1);
+    const __m128i above = _mm_set1_epi8('9' + 1);
+    while (end - p >= 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        __m128i digits = _mm_and_si128(_mm_cmpgt_epi8(bytes, below), _mm_cmplt_epi8(bytes, above));
+        u32 mask = u32(_mm_movemask_epi8(digits));
+        if (mask != 0xffff) return std::size_t(p - start) + std::size_t(__builtin_ctz(~mask));
+        p += 16;
+    }
+#endif
+    while (p != end && u32(*p - '0') <= 9) ++p;
+    return std::size_t(p - start);
+}
+
+InputStream::~InputStream() {
+#ifndef _WIN32
+    if (mapping) munmap(mapping, mapping_size);
+#endif
+    if (file && file != stdin) std::fclose(file);
+}
+
+bool InputStream::open(const char *path_) {
+    if (std::strcmp(path_, "-") == 0) {
+        file = stdin;
+        path = "stdin";
+    } else {
+        file = std::fopen(path_, "rb");
+        path = path_;
+        if (!file) return false;
+    }
+
+    at_eof = false;
+    if (map_file()) return true;
+
+    buffer.resize(BUFFER_SIZE);
+    pos = end = buffer.data();
+    return true;
+}
+
+bool InputStream::map_file() {
+#ifndef _WIN32
+    // Regular files (stdin too, when redirected from one) are mapped whole. Reading a
+    // number is then just parsing it, with no copying or system calls in between.
+    int fd = fileno(file);
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) return false;
+
+    off_t offset = lseek(fd, 0, SEEK_CUR); // something might have read stdin already
+    if (offset < 0 || offset >= info.st_size) return false;
+
+    void *data = mmap(nullptr, std::size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) return false;
+    madvise(data, std::size_t(info.st_size), MADV_SEQUENTIAL);
+
+    mapping = static_cast<char *>(data);
+    mapping_size = std::size_t(info.st_size);
+    start = mapping + offset;
+    pos = start;
+    end = mapping + mapping_size;
+    at_eof = true; // nothing more to read, it's all there
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool InputStream::refill() {
+    if (at_eof) return false;
+
+    std::size_t left = std::size_t(end - pos);
+    std::memmove(buffer.data(), pos, left);
+    pos = buffer.data();
+    end = pos + left;
+
+    std::size_t read = std::fread(buffer.data() + left, 1, buffer.size() - left, file);
+    if (read < buffer.size() - left) at_eof = true;
+    end += read;
+    return read != 0;
+}
+
+bool InputStream::rewind() {
+    if (mapping) {
+        pos = start;
+        return true;
+    }
+
+    if (file == stdin || std::fseek(file, 0, SEEK_SET) != 0) return false;
+    pos = end = buffer.data();
+    at_eof = false;
+    return true;
+}
+
+InputStream::Status InputStream::fail(Status status) {
+    const char *token_end = pos;
+    while (token_end != end && !is_space(*token_end)) ++token_end;
+
+    std::size_t length = std::size_t(token_end - pos);
+    bad_token.assign(pos, std::min(length, MAX_SHOWN_TOKEN));
+    if (length > MAX_SHOWN_TOKEN) bad_token += "...";
+    pos = token_end;
+    return status;
+}
+
+bool InputStream::skip_space() {
+    while (true) {
+        while (pos != end && is_space(*pos)) ++pos;
+        if (pos != end) break;
+        if (!refill()) return false;
+    }
+    if (end - pos < MAX_TOKEN) refill();
+    return true;
+}
+
+InputStream::Status InputStream::next(i32 &out) {
+    if (!skip_space()) return Status::END;
+
+    const char *p = pos;
+    bool negative = *p == '-';
+    if (*p == '-' || *p == '+') ++p;
+
+    std::size_t length = digit_run(p, end);
+    const char *digits_end = p + length;
+    if (length == 0 || (digits_end != end && !is_space(*digits_end))) return fail(Status::MALFORMED);
+
+    while (length > 1 && *p == '0') {
+        ++p;
+        --length;
+    }
+    if (length > 10) return fail(Status::OUT_OF_RANGE);
+
+    u64 magnitude = 0;
+    for (; p != digits_end; ++p) magnitude = magnitude * 10 + u32(*p - '0');
+    if (magnitude > u64(INT32_MAX) + negative) return fail(Status::OUT_OF_RANGE);
+
+    out = negative ? i32(-i64(magnitude)) : i32(magnitude);
+    pos = digits_end;
+    return Status::OK;
+}
+
+InputStream::Status InputStream::next_float(f32 &out) {
+    if (!skip_space()) return Status::END;
+
+    const char *token_end = pos;
+    while (token_end != end && !is_space(*token_end)) ++token_end;
+
+    auto [parsed_end, error] = std::from_chars(pos, token_end, out);
+    if (error == std::errc::result_out_of_range) return fail(Status::OUT_OF_RANGE);
+    if (error != std::errc{} || parsed_end != token_end) return fail(Status::MALFORMED);
+
+    pos = token_end;
+    return Status::OK;
+}
+
+InputStream::Status InputStream::next_char(i32 &out) {
+    if (pos == end && !refill()) return Status::END;
+    out = u8(*pos++);
+    return Status::OK;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "types.hpp"
+
+// Integers for IN =KBD from a file or stdin, parsed by hand rather than through std::cin.
+// Numbers are separated by any whitespace. Floats and single characters can be read too,
+// for the extension devices. Regular files are memory mapped, anything else is read in
+// large blocks. Used with --input, where nobody is sitting at the keyboard to answer a
+// prompt.
+class InputStream {
+public:
+    enum class Status {
+        OK,
+        END,          // no numbers left
+        MALFORMED,    // see token()
+        OUT_OF_RANGE, // doesn't fit in 32 bits, see token()
+    };
+
+    InputStream() = default;
+    ~InputStream();
+
+    InputStream(const InputStream &) = delete;
+    InputStream &operator=(const InputStream &) = delete;
+
+    // A `path` of "-" reads stdin. Returns false if the file can't be opened.
+    bool open(const char *path);
+
+    bool is_open() const { return file != nullptr; }
+
+    // "stdin" or the path given to open(), for error messages
+    const char *name() const { return path; }
+
+    Status next(i32 &out);
+
+    // For IN =FKBD, anything std::from_chars takes as a float
+    Status next_float(f32 &out);
+
+    // For IN =CKBD, the next byte as is, whitespace included
+    Status next_char(i32 &out);
+
+    // The token the last next() failed on, shortened if it was very long
+    std::string_view token() const { return bad_token; }
+
+    // Starts over from the first number, for benchmark iterations. Fails for
+    // stdin and anything else that can't seek.
+    bool rewind();
+
+private:
+    bool map_file();
+
+    // Moves `pos` to the start of the next token. Returns false if there isn't one.
+    bool skip_space();
+
+    // Moves what's left to the front of the buffer and reads more after it.
+    // Returns false if nothing more could be read.
+    bool refill();
+
+    // Skips the rest of the token at `pos`, remembering it for token()
+    Status fail(Status status);
+
+    std::FILE *file = nullptr;
+    const char *path = nullptr;
+    bool at_eof = false;
+
+    char *mapping = nullptr;
+    std::size_t mapping_size = 0;
+    const char *start = nullptr; // where reading began in the mapping
+
+    std::vector<char> buffer;
+    const char *pos = nullptr;
+    const char *end = nullptr;
+
+    std::string bad_token;
+};
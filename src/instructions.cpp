@@ -53,6 +53,13 @@ static tsl::robin_map<u8, std::string_view> &instr_name_table() {
         { u8(InstructionType::EXT_IRET), "EXTRET" }, // Not officially part of the language  
 
         { u8(InstructionType::EXT_HALT), "EXT_HALT" }, // Not officially part of the language
+
+        { u8(InstructionType::EXT_TAILCALL), "EXT_TAILCALL" }, // Internal
+        { u8(InstructionType::EXT_FILL), "EXT_FILL" }, // Internal
+        { u8(InstructionType::EXT_COPY), "EXT_COPY" }, // Internal
+        { u8(InstructionType::EXT_SUM), "EXT_SUM" }, // Internal
+        { u8(InstructionType::EXT_MCALL), "EXT_MCALL" }, // Internal
+        { u8(InstructionType::EXT_MEXIT), "EXT_MEXIT" }, // Internal
     };
     return table;
 }
@@ -76,8 +83,16 @@ std::string_view register_name(Register reg) {
         case Register::R6: return "SP (R6)";
         case Register::R7: return "FP (R7)";
         case Register::EXT_ZR: return "ZR";
-        default: return "{??}";
+        default: break;
+    }
+
+    static constexpr std::string_view VIRTUAL_NAMES[NUM_VIRTUAL_REGISTERS] = {
+        "V0", "V1", "V2", "V3", "V4", "V5", "V6"
+    };
+    if (u32(reg) >= FIRST_VIRTUAL_REGISTER && u32(reg) < REGISTER_FILE_SIZE) {
+        return VIRTUAL_NAMES[u32(reg) - FIRST_VIRTUAL_REGISTER];
     }
+    return "{??}";
 }
 
 void debug_print(u32 ins, const char *end) {
@@ -53,6 +53,14 @@ enum class InstructionType : u8 {
 
     EXT_HALT, // NOT officially part of the language
 
+    EXT_TAILCALL, // Internal, emitted by the optimizer
+    EXT_FILL,     // Internal, emitted by the optimizer
+    EXT_COPY,     // Internal, emitted by the optimizer
+    EXT_SUM,      // Internal, emitted by the optimizer
+    EXT_MCALL,    // Internal, emitted by the optimizer
+    EXT_MEXIT,    // Internal, emitted by the optimizer
+
+
     NUM_INSTRUCTIONS // not an instruction.
 };
 
@@ -104,13 +112,21 @@ void debug_print(u32 instruction, const char *end = "\n");
 
 constexpr u32 INSTRUCTION_BITS = 6; // 64 opcodes
 constexpr u32 ADDRESS_MODE_BITS = 2;
+constexpr u32 BOUNDS_PROVEN_BITS = 1; // Set by the optimizer when no bounds checks are needed
 constexpr u32 DST_REGISTER_BITS = 3;
 constexpr u32 SRC_REGISTER_BITS = 4; // To fit EXT_ZR
 constexpr u32 VALUE_BITS = 16;
 
+// The source register field can name more registers than the machine has. The spare
+// ones are virtual registers that the optimizer promotes DC/DS variables into.
+constexpr u32 REGISTER_FILE_SIZE = 1 << SRC_REGISTER_BITS;
+constexpr u32 FIRST_VIRTUAL_REGISTER = u32(Register::EXT_ZR) + 1;
+constexpr u32 NUM_VIRTUAL_REGISTERS = REGISTER_FILE_SIZE - FIRST_VIRTUAL_REGISTER;
+
 #define OPC_OFFSET 0
 #define ADDRM_OFFSET (INSTRUCTION_BITS)
-#define DST_OFFSET (ADDRM_OFFSET + ADDRESS_MODE_BITS)
+#define PROVEN_OFFSET (ADDRM_OFFSET + ADDRESS_MODE_BITS)
+#define DST_OFFSET (PROVEN_OFFSET + BOUNDS_PROVEN_BITS)
 #define SRC_OFFSET (DST_OFFSET + DST_REGISTER_BITS)
 #define VALUE_OFFSET (SRC_OFFSET + SRC_REGISTER_BITS)
 
@@ -126,12 +142,19 @@ inline u32 decode_src(u32 data) { return (data >> SRC_OFFSET) & ((1 << SRC_REGIS
 inline u32 encode_addrm(AddressMode mode) { return u32(mode) << ADDRM_OFFSET; }
 inline u32 decode_addrm(u32 data) { return (data >> ADDRM_OFFSET) & ((1 << ADDRESS_MODE_BITS) - 1); }
 
+inline u32 encode_bounds_proven(bool proven) { return u32(proven) << PROVEN_OFFSET; }
+inline bool decode_bounds_proven(u32 data) { return (data >> PROVEN_OFFSET) & 1; }
+
+// Address mode and the bounds proven flag in one, for picking between checked and unchecked loads
+inline u32 decode_load_path(u32 data) { return (data >> ADDRM_OFFSET) & ((1 << (ADDRESS_MODE_BITS + BOUNDS_PROVEN_BITS)) - 1); }
+
 inline u32 encode_value(i16 idx) { return u32(idx) << VALUE_OFFSET; }
 inline i16 decode_value(u32 data) { return i16((data >> VALUE_OFFSET) & ((1 << VALUE_BITS) - 1)); }
 
 #undef VALUE_OFFSET
 #undef SRC_OFFSET
 #undef DST_OFFSET
+#undef PROVEN_OFFSET
 #undef ADDRM_OFFSET
 #undef OPC_OFFSET
 
@@ -1,15 +1,33 @@
 #include "interpreter.hpp"
+#include "input.hpp"
+#include "async_writer.hpp"
+#include "devices.hpp"
 
 #include <cstdio>
 #include <chrono>
 #include <iostream>
 #include <cmath>
+#include <cstring>
+#include <cctype>
+#include <charconv>
+#include <algorithm>
+#include <optional>
+#include <bit>
+
+#ifdef _WIN32
+#include <conio.h>
+#else
+#include <poll.h>
+#include <unistd.h>
+#endif
 
 #define REG(_reg) *(mem-i64(Register::_reg))
 #define DST_ADDR(_instruction) -i64(decode_dst(_instruction))
 #define SRC_ADDR(_instruction) -i64(decode_src(_instruction))
 #define DST_REG(_ins) *(mem+DST_ADDR(ins))
 #define SRC_REG(_ins) *(mem+SRC_ADDR(ins))
+// Value of some other instruction than the current one, inside run()
+#define VALUE_AT(_ptr) (WIDE ? operands[(_ptr) - instructions] : decode_value(*(_ptr)))
 
 __attribute__((noinline))
 static void print_timings(u64 exec_time, u64 iterations);
@@ -21,44 +39,283 @@ __attribute__((noinline))
 static void print_oob_access_report(u32 instruction_idx, Runtime &rt);
 
 __attribute__((noinline))
-static void op_print(i32 *mem, u32 ins, i32 value) {
-    std::printf("%d\n", DST_REG(ins));
+static void print_stats(Runtime &rt, const Options &opts);
 
-    // TODO add other modes of printing and don't assume value == CRT
-    (void)value;
+__attribute__((noinline))
+static void print_input_error(InputStream::Status status, const InputStream &in, i32 device);
+
+// --output-digest: OUT values are hashed instead of printed. A round of xxHash64 per
+// value, so the digest depends on the order of the values too.
+struct OutputDigest {
+    static constexpr u64 PRIME1 = 0x9e3779b185ebca87ull;
+    static constexpr u64 PRIME2 = 0xc2b2ae3d27d4eb4full;
+    static constexpr u64 PRIME3 = 0x165667b19e3779f9ull;
+
+    u64 hash = PRIME1;
+    u64 count = 0;
+
+    // Mixing in the device keeps `OUT R1, =CCRT` apart from `OUT R1, =CRT`
+    void add(i32 value, i32 device) {
+        hash += (u64(u32(value)) | u64(device) << 32) * PRIME2;
+        hash = (hash << 31) | (hash >> 33);
+        hash *= PRIME1;
+        count += 1;
+    }
+
+    u64 finish() const {
+        u64 h = hash ^ (count * PRIME3);
+        h ^= h >> 33;
+        h *= PRIME2;
+        h ^= h >> 29;
+        h *= PRIME3;
+        h ^= h >> 32;
+        return h;
+    }
+};
+
+// --expect: what OUT should print, checked value by value as the program runs
+struct ExpectedOutput {
+    std::vector<i32> values;
+    u64 matched = 0;
+};
+
+__attribute__((noinline))
+static bool load_expected_output(const char *path, ExpectedOutput &out) {
+    InputStream file;
+    if (!file.open(path)) {
+        std::printf("Error: Could not open expected output file \"%s\"\n", path);
+        return false;
+    }
+
+    i32 value;
+    InputStream::Status status;
+    while ((status = file.next(value)) == InputStream::Status::OK) {
+        out.values.push_back(value);
+    }
+    if (status != InputStream::Status::END) {
+        std::printf("Error: Expected output \"%s\" should only have 32-bit integers, got \"%.*s\"\n",
+            path, int(file.token().size()), file.token().data());
+        return false;
+    }
+    return true;
 }
 
+// What OUT prints collects here and goes to stdout in large chunks, instead of
+// going through printf's formatting and locking once per number.
+struct OutputBuffer {
+    static constexpr u32 CAPACITY = 1 << 16;
+    AsyncWriter *async = nullptr; // --async-output, takes the numbers instead of the buffer
+    OutputDigest *digest = nullptr; // --output-digest, same
+    std::vector<i32> *values = nullptr; // Runtime::output, same
+    std::string *text = nullptr; // Runtime::output, gets the buffer's contents instead of stdout
+    bool diverted = false; // any of async, digest or values, so printing to stdout only checks once
+    u32 size = 0;
+    char data[CAPACITY];
+};
+
+// Called when the buffer fills up, before reading input, on halt and before error reports
 __attribute__((noinline))
-static void op_input(i32 *mem, u32 ins, i32 value) {
-    std::printf("(Requesting input)\n> ");
-    i32 input;
-    std::cin >> input;
-    DST_REG(ins) = input;
+static void flush_output(OutputBuffer &out) {
+    if (out.async) {
+        out.async->drain();
+        return;
+    }
+    if (out.size == 0) return;
+    if (out.text) out.text->append(out.data, out.size);
+    else std::fwrite(out.data, 1, out.size, stdout);
+    out.size = 0;
+}
 
-    (void)value;
+// Returns false if the value should still go into the buffer
+__attribute__((noinline))
+static bool divert_output(OutputBuffer &out, i32 value, i32 device) {
+    if (out.digest) {
+        out.digest->add(value, device);
+        return true;
+    }
+    if (out.async) {
+        out.async->push(value, device);
+        return true;
+    }
+    out.values->push_back(value);
+    return !out.text;
 }
 
-bool execute(Runtime &rt, Options &opts) {
+// `device` is one of OutDevices, see format_output()
+static void op_print(OutputBuffer &out, i32 *mem, u32 ins, i32 device) {
+    if (out.diverted) [[unlikely]] {
+        if (divert_output(out, DST_REG(ins), device)) return;
+    }
+
+    if (out.size > OutputBuffer::CAPACITY - MAX_OUTPUT_TEXT) flush_output(out);
+
+    char *begin = out.data + out.size;
+    out.size += u32(format_output(begin, DST_REG(ins), device) - begin);
+}
+
+// For IN =CKBD_NIO without --input: whether a character can be read without waiting
+static bool stdin_ready() {
+#ifdef _WIN32
+    return _kbhit() != 0;
+#else
+#ifdef __GLIBC__
+    if (stdin->_IO_read_ptr < stdin->_IO_read_end) return true; // already in stdio's buffer
+#endif
+    pollfd fd{ STDIN_FILENO, POLLIN, 0 };
+    return poll(&fd, 1, 0) > 0;
+#endif
+}
+
+__attribute__((noinline))
+// `device` is one of InDevices. The character devices give -1 once the input runs out,
+// and CKBD_NIO also when nothing has been typed yet.
+static InputStream::Status op_input(OutputBuffer &out, InputStream &in, i32 *mem, u32 ins, i32 device) {
+    i32 &dst = DST_REG(ins);
+
+    // --input: no prompt, and nothing to show before it
+    if (in.is_open()) {
+        switch (InDevices(device)) {
+        case InDevices::KBD:
+            return in.next(dst);
+        case InDevices::EXT_FKBD: {
+            f32 input{};
+            auto status = in.next_float(input);
+            dst = std::bit_cast<i32>(input);
+            return status;
+        }
+        case InDevices::EXT_CKBD:
+        case InDevices::EXT_CKBD_NIO:
+            if (in.next_char(dst) == InputStream::Status::END) dst = -1;
+            return InputStream::Status::OK;
+        }
+    }
+
+    flush_output(out);
+    switch (InDevices(device)) {
+    case InDevices::KBD: {
+        std::printf("(Requesting input)\n> ");
+        std::fflush(stdout);
+        i32 input;
+        std::cin >> input;
+        dst = input;
+        break;
+    }
+    case InDevices::EXT_FKBD: {
+        std::printf("(Requesting input)\n> ");
+        std::fflush(stdout);
+        f32 input{};
+        std::cin >> input;
+        dst = std::bit_cast<i32>(input);
+        break;
+    }
+    case InDevices::EXT_CKBD:
+    case InDevices::EXT_CKBD_NIO: {
+        std::fflush(stdout);
+        if (InDevices(device) == InDevices::EXT_CKBD_NIO && !stdin_ready()) {
+            dst = -1;
+            break;
+        }
+        int c = std::getchar();
+        dst = c == EOF ? -1 : c;
+        break;
+    }
+    }
+    return InputStream::Status::OK;
+}
+
+// For the bulk opcodes emitted by recognize_loop_idioms() (see optimizer.cpp).
+// `tail` points at the COMP of the loop, `comp_value` is its value, and `index` is the index
+// register at the head. Returns the number of iterations left; `bound` receives the value
+// compared against.
+static i64 loop_trip_count(i32 *mem, u32 const *tail, i32 comp_value, i32 index, i32 &bound) {
+    u32 comp = tail[0];
+    i64 limit = comp_value;
+    if (AddressMode(decode_addrm(comp)) == AddressMode::REGISTER) limit += *(mem - i64(decode_src(comp)));
+    bound = i32(limit);
+
+    // The index is compared after being incremented, and the body always runs at least once
+    i64 left = limit - index;
+    if (InstructionType(decode_opcode(tail[1])) == InstructionType::JNGRE) left += 1;
+    return std::max<i64>(left, 1);
+}
+
+static MemoEntry &memo_entry(MemoCache &memo, u32 function, const i32 *args, u32 num_args) {
+    u64 hash = (function + 1) * 0x9e3779b97f4a7c15ull;
+    for (u32 i = 0; i < num_args; ++i) {
+        hash = (hash ^ u32(args[i])) * 0x9e3779b97f4a7c15ull;
+    }
+    return memo.entries[(hash >> 32) & (MEMO_CACHE_ENTRIES - 1)];
+}
+
+static bool memo_matches(const MemoEntry &entry, u32 generation, u32 function, const i32 *args, u32 num_args) {
+    if (entry.generation != generation || entry.function != function) return false;
+    return std::equal(args, args + num_args, entry.args);
+}
+
+static i32 sum_words(const i32 *words, i64 count) {
+    // Wraps around like the ADDs it replaces. Simple enough for the compiler to vectorize.
+    u32 sum = 0;
+    for (i64 i = 0; i < count; ++i) sum += u32(words[i]);
+    return i32(sum);
+}
+
+// Precomputing runs the program silently under an instruction budget, and bails out
+// (returns false) on anything that would need the outside world or an error report.
+template<bool PRECOMPUTE, bool WIDE>
+static bool run(Runtime &rt, Options &opts, u64 budget, Precomputation *result) {
     u32 const *const instructions = rt.instructions.data();
     u32 const *pc = &instructions[0];
     u64 num_instructions = rt.instructions.size();
 
-    i32 *mem = rt.memory.data() + u64(Register::NUM_REGISTERS);
+    // Values of the instruction at the same index, see Program::wide_operands
+    i32 const *const operands = rt.operands.data();
+
+    i32 *mem = rt.memory.data() + u64(REGISTER_FILE_SIZE);
     i32 *mem_end = rt.memory.data() + rt.memory.size();
-    u32 highest_address = u32(mem_end - mem);
+    u32 highest_address = u32(mem_end - mem) - 1;
 
     // Cut off a couple indices from both ends to make over/underflow checks easier/faster. 
     // Nobody cares about 16 slots anyways :)
-    i32 stack_start_idx = rt.memory.size() - opts.stack_size + 8;
-    i32 stack_end_idx = stack_start_idx + opts.stack_size - 16;
+    i32 stack_start_idx = i32(highest_address + 1 - opts.stack_size + STACK_GUARD_WORDS);
+    i32 stack_end_idx = stack_start_idx + opts.stack_size - 2 * STACK_GUARD_WORDS;
 
     i32 &sp = REG(SP); // stack pointer
     i32 &fp = REG(FP); // frame pointer
-    sp = stack_start_idx;
-    fp = stack_start_idx;
 
     i32 comp_result{};
-    bool enable_printing = opts.bench_io || opts.benchmark_iterations == 1; // always print if not benchmarking
+    // Always print if not benchmarking. Digests cost next to nothing, so they're kept either way.
+    bool enable_printing = opts.bench_io || opts.benchmark_iterations == 1 || opts.output_digest;
+    OutputBuffer output;
+    OutputDigest digest;
+    std::optional<AsyncWriter> writer;
+    if constexpr (!PRECOMPUTE) {
+        if (rt.output.values || rt.output.text) {
+            output.values = rt.output.values;
+            output.text = rt.output.text;
+        } else if (opts.output_digest) {
+            output.digest = &digest;
+        } else if (opts.async_output && enable_printing) {
+            output.async = &writer.emplace();
+        }
+        output.diverted = output.async || output.digest || output.values;
+    }
+
+    InputStream input;
+    InputStream::Status input_status{};
+    if constexpr (!PRECOMPUTE) {
+        if (opts.input_file.data() && !input.open(opts.input_file.data())) {
+            std::printf("Error: Could not open input file \"%s\"\n", opts.input_file.data());
+            return false;
+        }
+    }
+
+    ExpectedOutput expected;
+    bool check_output = false;
+    bool output_matched = false; // all of it, by the time the program halted
+    if constexpr (!PRECOMPUTE) {
+        check_output = opts.expect_file.data() != nullptr;
+        if (check_output && !load_expected_output(opts.expect_file.data(), expected)) return false;
+    }
 
     // Compiler extension. Supported by GCC / Clang.
     // Produces FAR better code than a table of function pointers or a switch.
@@ -113,26 +370,39 @@ bool execute(Runtime &rt, Options &opts) {
 
         &&Lop_halt,
 
+        &&Lop_tailcall,
+        &&Lop_fill,
+        &&Lop_copy,
+        &&Lop_sum,
+        &&Lop_mcall,
+        &&Lop_mexit,
+
         // Fill remaining possible opcodes with error handling
         &&Leillegal_instruction, &&Leillegal_instruction, &&Leillegal_instruction, &&Leillegal_instruction,
         &&Leillegal_instruction, &&Leillegal_instruction, &&Leillegal_instruction, &&Leillegal_instruction,
         &&Leillegal_instruction, &&Leillegal_instruction, &&Leillegal_instruction, &&Leillegal_instruction,
         &&Leillegal_instruction, &&Leillegal_instruction, &&Leillegal_instruction, &&Leillegal_instruction,
-        &&Leillegal_instruction, &&Leillegal_instruction, &&Leillegal_instruction, &&Leillegal_instruction,
-        &&Leillegal_instruction, &&Leillegal_instruction, &&Leillegal_instruction, &&Leillegal_instruction,
-        &&Leillegal_instruction,
+        &&Leillegal_instruction, &&Leillegal_instruction, &&Leillegal_instruction,
     };
+    static_assert(sizeof(INS_JUMP_TABLE) / sizeof(void*) == 1 << INSTRUCTION_BITS);
 
+    // Indexed by the address mode and the bounds proven flag (see decode_load_path())
     constexpr void* VAL_JUMP_TABLE[] = {
         &&Lload_immediate_val,
         &&Lload_register_val,
         &&Lload_direct_val,
         &&Lload_indirect_val,
+
+        &&Lload_immediate_val,
+        &&Lload_register_val,
+        &&Lload_direct_val_unchecked,
+        &&Lload_indirect_val_unchecked,
     };
 
     auto start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::duration reset_time{}; // not part of the benchmark
 
-    u64 remaining_executions = opts.benchmark_iterations;
+    u64 remaining_executions = PRECOMPUTE ? 1 : opts.benchmark_iterations;
     if (remaining_executions != 1) {
         std::printf("Running %llu iterations\n\n", remaining_executions);
     }
@@ -143,17 +413,30 @@ bool execute(Runtime &rt, Options &opts) {
 Lstart:
     remaining_executions -= 1;
     pc = &instructions[0];
+    rt.memo.generation += 1; // results can't be reused across benchmark iterations
+    digest = {}; // each iteration prints the same output
+    expected.matched = 0;
+    sp = stack_start_idx;
+    fp = stack_start_idx;
+    comp_result = {};
 
     u32 executed_instructions = 0;
 
     while (true) {
         executed_instructions += 1;
+        if constexpr (PRECOMPUTE) {
+            if (executed_instructions > budget) return false;
+        }
         u32 ins = *pc++;
         
         i32 opcode = decode_opcode(ins);
         auto op = INS_JUMP_TABLE[opcode];
         
-        value = decode_value(ins);
+        if constexpr (WIDE) {
+            value = operands[pc - 1 - instructions];
+        } else {
+            value = decode_value(ins);
+        }
 
         i32 &src = SRC_REG(ins);
         i32 &dst = DST_REG(ins);
@@ -162,7 +445,7 @@ Lstart:
         // Start by decoding value, regardless of opcode
         //
 
-        goto *VAL_JUMP_TABLE[decode_addrm(ins)];
+        goto *VAL_JUMP_TABLE[decode_load_path(ins)];
 
         Lload_immediate_val: // 0 memory accesses :)
         goto *op;
@@ -187,6 +470,20 @@ Lstart:
         value = mem[value];
         goto *op;
 
+        // The optimizer proved these to be in bounds.
+        // For indirect loads that only covers the first access.
+
+        Lload_direct_val_unchecked:
+        value = mem[value + src];
+        goto *op;
+
+        Lload_indirect_val_unchecked:
+        value = mem[value + src];
+        if (u32(value) > highest_address) goto Leout_of_bounds;
+
+        value = mem[value];
+        goto *op;
+
         //
         // OPERATIONS
         // Ordered very approximately from most important to least important
@@ -197,6 +494,7 @@ Lstart:
         continue;
 
         Lop_store:
+        if (u32(value) > highest_address && !decode_bounds_proven(ins)) goto Leout_of_bounds;
         mem[value] = dst;
         continue;
 
@@ -306,6 +604,127 @@ Lstart:
         if (sp < stack_start_idx) goto Lestack_underflow;
         continue;
 
+        Lop_tailcall: { // CALL directly followed by EXIT, see optimizer.cpp
+            // Rather than returning here just to return again, move the arguments
+            // over the current frame so that the callee returns straight to our caller.
+            // With src set, a POP and a STORE that copy the callee's result into our
+            // return slot come before the EXIT, and the callee's return slot replaces ours.
+            i32 num_params = decode_src(ins) ? VALUE_AT(pc + 2) + 1 : VALUE_AT(pc); // of the EXIT
+            i32 num_args = sp - fp;
+            i32 base = fp - 2 - num_params; // SP after the EXIT
+            if (num_args < 0 || base < stack_start_idx) goto Lop_call; // let CALL/EXIT deal with it
+
+            i32 return_addr = mem[fp - 1];
+            i32 caller_fp = mem[fp];
+            std::memmove(&mem[base + 1], &mem[fp + 1], u64(num_args) * sizeof(i32));
+
+            sp = base + num_args;
+            mem[++sp] = return_addr;
+            mem[++sp] = caller_fp;
+            pc = &instructions[0] + value;
+            fp = sp;
+            continue;
+        }
+
+        // Whole array loops, see recognize_loop_idioms() in optimizer.cpp.
+        // The iterations that stay in bounds are done in one go. If that isn't all of them,
+        // execution continues from the head of the loop, where the original instruction
+        // (with `value` already loaded like it would have) takes over and reports the error.
+        Lop_fill: { // STORE Rv, A(Ri); ADD Ri, =1; COMP; JLES
+            i32 bound;
+            i64 n = loop_trip_count(mem, pc + 1, VALUE_AT(pc + 1), src, bound);
+            i64 first = i64(src) + VALUE_AT(pc - 1);
+            i64 k = std::min(n, i64(highest_address) - first + 1);
+            if (first < 1 || k < 1) goto Lop_store;
+
+            std::fill_n(mem + first, k, dst);
+            src += i32(k);
+            comp_result = src - bound;
+            pc += (k == n) ? 3 : -1;
+            executed_instructions += u32(4 * k - 1);
+            continue;
+        }
+
+        Lop_copy: { // LOAD Rt, A(Ri); STORE Rt, B(Ri); ADD Ri, =1; COMP; JLES
+            i32 bound;
+            i64 n = loop_trip_count(mem, pc + 2, VALUE_AT(pc + 2), src, bound);
+            i64 from = i64(src) + VALUE_AT(pc - 1);
+            i64 to = i64(src) + VALUE_AT(pc);
+            i64 k = std::min(n, i64(highest_address) - std::max(from, to) + 1);
+            if (std::min(from, to) < 1 || k < 1) goto Lop_load;
+
+            if (to <= from || to >= from + k) {
+                std::memmove(mem + to, mem + from, u64(k) * sizeof(i32));
+            } else {
+                // Copying forwards into an overlapping range repeats the start, unlike memmove
+                for (i64 i = 0; i < k; ++i) mem[to + i] = mem[from + i];
+            }
+            dst = mem[to + k - 1];
+            src += i32(k);
+            comp_result = src - bound;
+            pc += (k == n) ? 4 : -1;
+            executed_instructions += u32(5 * k - 1);
+            continue;
+        }
+
+        Lop_sum: { // ADD Rs, A(Ri); ADD Ri, =1; COMP; JLES
+            i32 bound;
+            i64 n = loop_trip_count(mem, pc + 1, VALUE_AT(pc + 1), src, bound);
+            i64 first = i64(src) + VALUE_AT(pc - 1);
+            i64 k = std::min(n, i64(highest_address) - first + 1);
+            if (first < 1 || k < 1) goto Lop_add;
+
+            dst = i32(u32(dst) + u32(sum_words(mem + first, k)));
+            src += i32(k);
+            comp_result = src - bound;
+            pc += (k == n) ? 3 : -1;
+            executed_instructions += u32(4 * k - 1);
+            continue;
+        }
+
+        // CALL/EXIT of a subroutine that only depends on its parameters, see Optimizer::memoize().
+        // Counts as a single instruction when the result was cached.
+        Lop_mcall: {
+            u32 num_args = decode_dst(ins);
+            i32 *args = &mem[sp + 1 - i32(num_args)];
+            if (sp - i32(num_args) < stack_start_idx) goto Lop_call; // let EXIT report the underflow
+
+            MemoEntry &entry = memo_entry(rt.memo, u32(value), args, num_args);
+            rt.memo.calls += 1;
+            if (!memo_matches(entry, rt.memo.generation, u32(value), args, num_args)) goto Lop_call;
+
+            rt.memo.hits += 1;
+            sp -= i32(num_args);
+            mem[sp] = entry.result;
+            if (decode_src(ins)) comp_result = entry.comp_result;
+            continue;
+        }
+
+        Lop_mexit: {
+            fp = mem[sp--];
+            pc = mem[sp--] + &instructions[0];
+            sp -= value;
+            if (sp < stack_start_idx) goto Lestack_underflow;
+
+            // Cache the result if this returns to an EXT_MCALL that agrees on the parameters.
+            // Anything else doesn't follow the calling convention and isn't worth caching.
+            u64 call_idx = u64(pc - &instructions[0]) - 1;
+            if (call_idx >= num_instructions) continue;
+            u32 call = instructions[call_idx];
+            if (InstructionType(decode_opcode(call)) != InstructionType::EXT_MCALL || i32(decode_dst(call)) != value) continue;
+
+            u32 function = u32(VALUE_AT(&instructions[call_idx]));
+            MemoEntry &entry = memo_entry(rt.memo, function, &mem[sp + 1], u32(value));
+            if (entry.generation == rt.memo.generation) rt.memo.evictions += 1;
+
+            entry.generation = rt.memo.generation;
+            entry.function = function;
+            std::copy_n(&mem[sp + 1], value, entry.args);
+            entry.result = mem[sp];
+            entry.comp_result = comp_result;
+            continue;
+        }
+
         Lop_push:  
         mem[++sp] = value;
         if (sp >= stack_end_idx) goto Lestack_overflow;
@@ -337,11 +756,25 @@ Lstart:
         continue;
 
         Lop_in: 
-        op_input(mem, ins, value); 
+        if constexpr (PRECOMPUTE) return false;
+        input_status = op_input(output, input, mem, ins, value);
+        if (input_status != InputStream::Status::OK) goto Lebad_input;
         continue;
         
         Lop_out: 
-        if (enable_printing) op_print(mem, ins, value);
+        if constexpr (PRECOMPUTE) {
+            char buf[MAX_OUTPUT_TEXT];
+            result->output.append(buf, format_output(buf, dst, value));
+            continue;
+        }
+        if (check_output) {
+            if (expected.matched == expected.values.size() || expected.values[expected.matched] != dst) {
+                value = dst; // for the report
+                goto Leoutput_mismatch;
+            }
+            expected.matched += 1;
+        }
+        if (enable_printing) op_print(output, mem, ins, value);
         continue;
 
         Lop_svc: continue;
@@ -350,54 +783,171 @@ Lstart:
 
 // Start of error handling spaghetti
 Leinvalid_jump_address:
+    if constexpr (PRECOMPUTE) return false; // leave the report to the real run
+    flush_output(output);
     std::printf("Execution error: Instruction #%d jumped out of bounds (jump address %d)\n", 
         (int)(pc - 1 - &instructions[0]), value);
     goto Lprint_faulty_instruction;
 
 Lestack_underflow:
+    if constexpr (PRECOMPUTE) return false;
+    flush_output(output);
     std::printf("Execution error: Stack underflowed. Possible reasons: \n");
     std::printf("- Tried to use EXIT to terminate the program (Use `SVC SP, =HALT` instead)\n");
     std::printf("- The number of parameters EXIT was asked to clean up was too big\n");
     goto Lprint_faulty_instruction;
 
 Lestack_overflow:
+    if constexpr (PRECOMPUTE) return false;
+    flush_output(output);
     std::printf("Execution error: Stack overflowed (recursion too deep?)\n");
     goto Lprint_faulty_instruction;
 
 Leout_of_bounds:
+    if constexpr (PRECOMPUTE) return false;
+    flush_output(output);
     print_oob_access_report(u32(pc - 1 - &instructions[0]), rt);
     goto Lprint_faulty_instruction;
 
 Ledivision_by_zero:
+    if constexpr (PRECOMPUTE) return false;
+    flush_output(output);
     std::printf("Execution error: Division by zero\n");
     goto Lprint_faulty_instruction;
 
 Leillegal_instruction:
+    if constexpr (PRECOMPUTE) return false;
+    flush_output(output);
     std::printf("Execution error: Illegal instruction (opcode %d)\n", decode_opcode(*(pc-1)));
     goto Lprint_faulty_instruction;
 
+Leoutput_mismatch:
+    if constexpr (PRECOMPUTE) return false;
+    flush_output(output);
+    if (expected.matched == expected.values.size()) {
+        std::printf("Wrong output: value #%llu is %d, but only %zu values were expected\n",
+            expected.matched + 1, value, expected.values.size());
+    } else {
+        std::printf("Wrong output: value #%llu is %d, expected %d\n",
+            expected.matched + 1, value, expected.values[expected.matched]);
+    }
+    goto Lprint_faulty_instruction;
+
+Leoutput_missing:
+    if constexpr (PRECOMPUTE) return false;
+    flush_output(output);
+    std::printf("Wrong output: the program halted after %llu of the %zu expected values\n",
+        expected.matched, expected.values.size());
+    goto Lhalt_no_repeat;
+
+Lebad_input:
+    if constexpr (PRECOMPUTE) return false;
+    flush_output(output);
+    print_input_error(input_status, input, value);
+    goto Lprint_faulty_instruction;
+
 Lprint_faulty_instruction:
     print_faulty_instruction(u32(pc - 1 - &instructions[0]), *rt.program_ref); 
     goto Lhalt_no_repeat;
 // End of error handling spaghetti
 
 Lop_halt:
-    if (remaining_executions != 0) goto Lstart;
+    if (check_output) {
+        if (expected.matched != expected.values.size()) goto Leoutput_missing;
+        output_matched = true;
+    }
+    if (remaining_executions != 0) {
+        // Every iteration starts from the same registers, data and stack as the first one
+        auto reset_start = std::chrono::steady_clock::now();
+        rt.memory.restore();
+        reset_time += std::chrono::steady_clock::now() - reset_start;
+        if (input.is_open() && !input.rewind()) {
+            std::printf("Error: Can't read \"%s\" again for the next iteration\n", input.name());
+            goto Lhalt_no_repeat;
+        }
+        goto Lstart;
+    }
 
 Lhalt_no_repeat:
     auto end = std::chrono::steady_clock::now();
 
-    std::printf("\nExecuted %d instructions\n", executed_instructions);
+    for (const auto &var : rt.program_ref->promoted_variables) {
+        mem[var.address] = *(mem - i64(var.reg));
+    }
 
     // See create_runtime() at the bottom of this file. Execution should never reach that instruction.
-    if (pc == rt.instructions.data() + rt.instructions.size()) {
+    bool missing_halt = pc == rt.instructions.data() + rt.instructions.size();
+
+    if constexpr (PRECOMPUTE) {
+        result->executed_instructions = executed_instructions;
+        result->missing_halt = missing_halt;
+        for (u32 r = 0; r < result->registers.size(); ++r) {
+            result->registers[r] = *(mem - i64(r));
+        }
+        return true;
+    }
+
+    flush_output(output);
+    if (output_matched) {
+        std::printf("Output matches all %zu expected values\n", expected.values.size());
+    }
+    if (output.digest) {
+        std::printf("Output digest: %016llx (%llu value%s)\n", digest.finish(), digest.count, digest.count == 1 ? "" : "s");
+    }
+    std::printf("\nExecuted %d instructions\n", executed_instructions);
+
+    if (missing_halt) {
         std::printf("Nag: no terminating instruction found. Perhaps you forgot the `SVC SP, =Halt`?\n");
     }
 
-    auto elapsed = (end - start).count();
+    if (opts.stats) print_stats(rt, opts);
+
+    auto elapsed = (end - start - reset_time).count();
     print_timings(elapsed, opts.benchmark_iterations);
 
-    return true;
+    // Wrong output fails the run, so that whoever runs it with --expect doesn't have to read the report
+    return !check_output || output_matched;
+}
+
+bool execute(Runtime &rt, Options &opts) {
+    if (!rt.operands.empty()) return run<false, true>(rt, opts, 0, nullptr);
+    return run<false, false>(rt, opts, 0, nullptr);
+}
+
+bool precompute(Runtime &rt, Options &opts, u64 budget, Precomputation &out) {
+    out.output.clear();
+    if (!rt.operands.empty()) return run<true, true>(rt, opts, budget, &out);
+    return run<true, false>(rt, opts, budget, &out);
+}
+
+void print_precomputed(const Precomputation &result) {
+    std::fwrite(result.output.data(), 1, result.output.size(), stdout);
+
+    std::printf("\nExecuted %llu instructions\n", (unsigned long long)result.executed_instructions);
+    if (result.missing_halt) {
+        std::printf("Nag: no terminating instruction found. Perhaps you forgot the `SVC SP, =Halt`?\n");
+    }
+    std::printf("Execution finished in 0ns (precomputed).\n");
+}
+
+__attribute__((noinline))
+static void print_input_error(InputStream::Status status, const InputStream &in, i32 device) {
+    bool is_float = InDevices(device) == InDevices::EXT_FKBD;
+    switch (status) {
+    case InputStream::Status::END:
+        std::printf("Execution error: Ran out of input, \"%s\" has no more numbers\n", in.name());
+        break;
+    case InputStream::Status::MALFORMED:
+        std::printf("Execution error: Expected %s in \"%s\", got \"%.*s\"\n",
+            is_float ? "a float" : "an integer", in.name(), int(in.token().size()), in.token().data());
+        break;
+    case InputStream::Status::OUT_OF_RANGE:
+        std::printf("Execution error: Input \"%.*s\" in \"%s\" doesn't fit in a 32-bit %s\n",
+            int(in.token().size()), in.token().data(), in.name(), is_float ? "float" : "integer");
+        break;
+    case InputStream::Status::OK:
+        break;
+    }
 }
 
 __attribute__((noinline))
@@ -447,6 +997,24 @@ static void print_timings(u64 exec_time, u64 iterations) {
     }
 }
 
+__attribute__((noinline))
+static void print_stats(Runtime &rt, const Options &opts) {
+    const auto &memo = rt.memo;
+    if (rt.program_ref->memoized_subroutines == 0) {
+        if (opts.memoize) {
+            std::printf("Memoization: no subroutines memoized, none were found to be pure\n");
+        } else {
+            std::printf("Memoization: no subroutines memoized (see --memoize)\n");
+        }
+        return;
+    }
+
+    f64 hit_rate = memo.calls == 0 ? 0.0 : 100.0 * f64(memo.hits) / f64(memo.calls);
+    std::printf("Memoization: %llu calls, %llu hits (%.1f%%), %llu evictions, %u subroutine%s\n",
+        memo.calls, memo.hits, hit_rate, memo.evictions,
+        rt.program_ref->memoized_subroutines, rt.program_ref->memoized_subroutines == 1 ? "" : "s");
+}
+
 __attribute__((noinline))
 static void print_oob_access_report(u32 instruction_idx, Runtime &rt) {
     // This error is so common it's more than worth it to spend effort on the error report.
@@ -454,16 +1022,27 @@ static void print_oob_access_report(u32 instruction_idx, Runtime &rt) {
     u32 ins = prog.instructions[instruction_idx];
     
     AddressMode addrm = AddressMode(decode_addrm(ins));
-    i16 value = decode_value(ins);
+    i32 value = prog.wide_operands.empty() ? decode_value(ins) : prog.wide_operands[instruction_idx];
+
+    // The bulk opcodes fail as the instruction they replaced
+    auto type = InstructionType(decode_opcode(ins));
+    if (type == InstructionType::EXT_FILL) type = InstructionType::STORE;
+    if (type == InstructionType::EXT_COPY) type = InstructionType::LOAD;
+    if (type == InstructionType::EXT_SUM) type = InstructionType::ADD;
+
+    // STORE's address mode is shifted down by one (see parse_store())
+    if (type == InstructionType::STORE) {
+        addrm = AddressMode(u32(addrm) + 1);
+    }
     Register src = Register(decode_src(ins));
 
     std::printf("\n");
     std::printf("Execution error: Instruction #%d (%s) accessed memory out of bounds!\n",
         instruction_idx,
-        instruction_name(InstructionType(decode_opcode(ins))).data()
+        instruction_name(type).data()
     );
     std::printf("- Valid addresses are 1 <= address <= %lld.\n", 
-        i64(rt.memory.data() + rt.memory.size()) - i64(Register::NUM_REGISTERS));
+        i64(rt.memory.size()) - i64(REGISTER_FILE_SIZE) - 1);
     
     if (addrm == AddressMode::IMMEDIATE) {
         std::printf("- Address mode for this instruction is 'immediate'.\n"
@@ -471,31 +1050,62 @@ static void print_oob_access_report(u32 instruction_idx, Runtime &rt) {
                     "  => This address is '%d'.\n", value);
     }
     else if (addrm == AddressMode::DIRECT) {
-        i32 reg_val = rt.memory[u64(Register::NUM_REGISTERS) - u64(src)];
+        i32 reg_val = rt.memory[u64(REGISTER_FILE_SIZE) - u64(src)];
         std::printf("- Address mode for this instruction is 'direct'.\n"
                     "- Source register %s has value %d, and the offset\n"
                     "  encoded in the instruction is %d.\n", register_name(src).data(), reg_val, value);
         std::printf("  => Faulty address is (%d) + (%d) = %d.\n", reg_val, value, reg_val + value);
     }
     else if (addrm == AddressMode::INDIRECT) {
-        i32 reg_val = rt.memory[u64(Register::NUM_REGISTERS) - u64(src)];
+        i32 reg_val = rt.memory[u64(REGISTER_FILE_SIZE) - u64(src)];
         std::printf("- Address mode for this instruction is 'indirect'.\n"
                     "- Source register %s has value %d, and the offset\n"
                     "  encoded in the instruction is %d.\n", register_name(src).data(), reg_val, value);
         std::printf("  => Direct address is (%d) + (%d) = %d.\n", reg_val, value, reg_val + value);
-        if (reg_val + value < 1 || reg_val + value > i32(prog.data_section_bytes)) {
+        if (reg_val + value < 1 || i64(reg_val) + value > i64(rt.memory.size()) - i64(REGISTER_FILE_SIZE) - 1) {
             std::printf("  .. which is out of bounds, and error occurs here.\n");
         } else {
             std::printf("- The address is valid, but the value at this address is\n"
-                        "  %d, which is out of bounds.", rt.memory[u64(Register::NUM_REGISTERS) + reg_val + value]);
+                        "  %d, which is out of bounds.\n", rt.memory[u64(REGISTER_FILE_SIZE) + reg_val + value]);
         }
     }
 }
 
+// Finds line `line_num` (counting from zero) in the source the program was compiled from.
+// Fails if the file is gone or has been edited since.
+static bool read_source_line(const Program &prog, u32 line_num, std::string &source, std::string_view &out) {
+    if (!Compiler::read_source(prog.source_file.c_str(), source)) return false;
+    if (hash_bytes(HASH_SEED, source.data(), source.size()) != prog.source_hash) return false;
+
+    std::size_t start = 0;
+    for (u32 i = 0; i < line_num; ++i) {
+        start = source.find('\n', start);
+        if (start == source.npos) return false;
+        start += 1;
+    }
+
+    std::size_t end = std::min(source.find('\n', start), source.size());
+
+    // Shown the way the compiler saw it, without indentation and comments
+    end = std::min(source.find(';', start), end);
+    while (start < end && std::isspace(u8(source[start]))) start += 1;
+    while (end > start && std::isspace(u8(source[end - 1]))) end -= 1;
+
+    out = std::string_view{ source.data() + start, end - start };
+    return true;
+}
+
 __attribute__((noinline))
 static void print_faulty_instruction(u32 instruction_idx, Program &prog) {
     u32 line_num = prog.instr_idx_to_line_idx[instruction_idx];
-    std::string_view line = prog.source_code_lines[line_num];
+
+    std::string source{};
+    std::string_view line{};
+    if (!read_source_line(prog, line_num, source, line)) {
+        std::printf("Error occurred during the execution of the instruction on line %u\n", line_num + 1);
+        std::printf("(can't show it, \"%s\" has changed since it was compiled)\n", prog.source_file.c_str());
+        return;
+    }
 
     std::printf("Error occurred during the execution of the instruction on line %u:\n", line_num + 1);
     std::printf(
@@ -506,6 +1116,58 @@ static void print_faulty_instruction(u32 instruction_idx, Program &prog) {
     );
 }
 
+// Registers and the data section, everything past them starts out as zero
+static std::size_t num_initialized_words(const Program &program) {
+    return std::size_t(REGISTER_FILE_SIZE) + program.data_section_bytes;
+}
+
+static void write_initial_memory(const Program &program, i32 *words) {
+    for (const auto &constant : program.constants) {
+        words[constant.address + std::size_t(REGISTER_FILE_SIZE)] = constant.value;
+    }
+
+    for (const auto &var : program.promoted_variables) {
+        words[std::size_t(REGISTER_FILE_SIZE) - std::size_t(var.reg)] =
+            words[std::size_t(REGISTER_FILE_SIZE) + var.address];
+    }
+}
+
+static void finish_runtime(Program &program, Runtime &out, Options &options) {
+    // Benchmark iterations are reset to this state, see execute()
+    if (options.benchmark_iterations > 1) {
+        out.memory.snapshot(num_initialized_words(program));
+    }
+
+    // A reused cache keeps its entries. They stay stale as long as the generation keeps counting up.
+    out.memo.calls = 0;
+    out.memo.hits = 0;
+    out.memo.evictions = 0;
+    if (program.memoized_subroutines > 0) {
+        out.memo.entries.resize(MEMO_CACHE_ENTRIES);
+    }
+
+    out.instructions = program.instructions;
+    out.operands = program.wide_operands;
+    out.output = {};
+    out.program_ref = &program;
+}
+
+static bool allocation_failed(std::size_t num_words) {
+    std::printf("Error: Could not allocate %llu MiB of memory for the program (try a smaller --stack-size)\n",
+        u64(num_words * sizeof(i32)) >> 20);
+    return false;
+}
+
+// Memory is allocated in size classes, so that pooled runtimes fit programs whose data
+// sections differ a bit (see RuntimePool): up to the next multiple of a quarter of the
+// largest power of two below the size, in whole pages. That is at most 25% more than
+// asked for, and pages that nothing touches are never committed.
+static std::size_t memory_size_class(std::size_t num_words) {
+    constexpr std::size_t PAGE_WORDS = 4096 / sizeof(i32);
+    std::size_t step = std::max(std::bit_floor(num_words) / 4, PAGE_WORDS);
+    return (num_words + step - 1) / step * step;
+}
+
 bool create_runtime(Program &program, Runtime &out, Options &options) {
     // Initialize memory as described in interpreter.hpp
     // Registers have the lowest addresses, then comes program data,
@@ -514,18 +1176,52 @@ bool create_runtime(Program &program, Runtime &out, Options &options) {
     // - No need for extra care for register access
     // - Stack still grows to higher addresses
 
-    out.memory.clear();
-    out.memory.resize(
-        std::size_t(Register::NUM_REGISTERS)
-        + program.data_section_bytes
-        + options.stack_size
-    );
+    std::size_t num_words = runtime_memory_words(program, options);
+    if (!out.memory.allocate(num_words, options.huge_pages, memory_size_class(num_words))) {
+        return allocation_failed(num_words);
+    }
+    if (options.huge_pages && !out.memory.uses_huge_pages()) {
+        std::printf("Note: Huge pages are not available on this system, using normal pages\n");
+    }
 
-    for (const auto &constant : program.constants) {
-        out.memory[constant.address + std::size_t(Register::NUM_REGISTERS)] = constant.value;
+    write_initial_memory(program, out.memory.data());
+    out.memo = MemoCache{};
+    finish_runtime(program, out, options);
+    return true;
+}
+
+std::size_t runtime_memory_words(const Program &program, const Options &options) {
+    return num_initialized_words(program) + options.stack_size;
+}
+
+bool reuse_runtime(Program &program, Runtime &out, Options &options) {
+    if (!out.memory.resize(runtime_memory_words(program, options))) return false;
+
+    write_initial_memory(program, out.memory.data());
+    finish_runtime(program, out, options);
+    return true;
+}
+
+bool create_runtime_image(Program &program, RuntimeImage &out, Options &options) {
+    // Same layout as create_runtime(). Huge pages don't apply, the image lives in the page cache.
+    std::vector<i32> words(num_initialized_words(program));
+    write_initial_memory(program, words.data());
+
+    std::size_t num_words = words.size() + options.stack_size;
+    if (!out.memory.create(words, num_words)) {
+        return allocation_failed(num_words);
     }
 
-    out.instructions = program.instructions;
     out.program_ref = &program;
     return true;
 }
+
+bool create_runtime(const RuntimeImage &image, Runtime &out, Options &options) {
+    if (!out.memory.map(image.memory)) {
+        return allocation_failed(image.memory.size());
+    }
+
+    out.memo = MemoCache{};
+    finish_runtime(*image.program_ref, out, options);
+    return true;
+}
@@ -3,20 +3,98 @@
 #include <vector>
 #include <array>
 #include <span>
+#include <string>
 
 #include "types.hpp"
 #include "instructions.hpp"
 #include "compiler.hpp"
 #include "options.hpp"
 #include "program.hpp"
+#include "memory.hpp"
+
+// Words left unused at both ends of the stack so that the over/underflow checks
+// can be done once per instruction rather than once per push/pop.
+constexpr i32 STACK_GUARD_WORDS = 8;
+
+// Memoized subroutines take at most this many parameters, see Optimizer::memoize()
+constexpr u32 MEMO_MAX_ARGS = 4;
+constexpr u32 MEMO_CACHE_ENTRIES = 1 << 16; // power of two
+
+struct MemoEntry {
+    u32 generation; // entries from earlier benchmark iterations are stale
+    u32 function;   // instruction index
+    i32 args[MEMO_MAX_ARGS];
+    i32 result;
+    i32 comp_result; // the COMP state it left behind
+};
+
+// Direct-mapped: a new result simply replaces whatever was in its slot
+struct MemoCache {
+    std::vector<MemoEntry> entries;
+    u32 generation;
+
+    u64 calls;
+    u64 hits;
+    u64 evictions;
+};
+
+// For running programs in-process: collects what OUT prints instead of sending it to
+// stdout. Set either or both on a runtime before execute(); they're only ever appended
+// to. Messages from the interpreter itself, such as errors and timings, still go to stdout.
+struct OutputCapture {
+    std::vector<i32> *values = nullptr; // the values as they are, whatever the device
+    std::string *text = nullptr;        // exactly the text that would have been printed
+};
 
 struct Runtime {
     std::span<u32> instructions;
-    std::vector<i32> memory;
+    std::span<i32> operands; // Program::wide_operands
+    Memory memory;
+    MemoCache memo;
+    OutputCapture output; // empty = stdout. Cleared when the runtime is created or reused.
 
     Program *program_ref;
 };
 
 bool create_runtime(Program &program, Runtime &out, Options &options);
 
+// Words of memory that a runtime for `program` needs with these options
+std::size_t runtime_memory_words(const Program &program, const Options &options);
+
+// Like create_runtime(), but keeps the memory and memo cache of an earlier runtime. Its memory
+// has to be all zeroes (see Memory::zero()) and have room for the program, otherwise returns
+// false. Used by RuntimePool.
+bool reuse_runtime(Program &program, Runtime &out, Options &options);
+
+// The initial memory of a program, built once for running it many times over. Runtimes
+// created from it share its pages until they write to them, so creating one costs about
+// the same no matter how large the data section and stack are.
+struct RuntimeImage {
+    MemoryImage memory;
+    Program *program_ref;
+};
+
+bool create_runtime_image(Program &program, RuntimeImage &out, Options &options);
+
+// `options` should match the ones the image was created with. The image itself
+// doesn't need to outlive the runtime.
+bool create_runtime(const RuntimeImage &image, Runtime &out, Options &options);
+
+// Returns false if the program couldn't be run, or if it was run with --expect and its
+// output didn't match, whether by a wrong value, a missing one or an error along the way.
 bool execute(Runtime &runtime, Options &options);
+
+// Everything a run of an input-free program leaves behind, see precompute.cpp
+struct Precomputation {
+    std::string output; // exactly as printed by OUT
+    u64 executed_instructions;
+    std::array<i32, 8> registers; // R0-R7 at the end
+    bool missing_halt; // ran off the end of the program
+};
+
+// Runs the program without printing anything. Fails if it doesn't halt within `budget`
+// instructions, tries to read input or runs into an error.
+bool precompute(Runtime &runtime, Options &options, u64 budget, Precomputation &out);
+
+// Prints the output of a precomputed run like execute() would have
+void print_precomputed(const Precomputation &result);
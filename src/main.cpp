@@ -1,5 +1,3 @@
-
-#include <fstream>
 #include <string_view>
 #include <iostream>
 #include <string>
@@ -8,38 +6,24 @@
 #include "types.hpp"
 #include "compiler.hpp"
 #include "interpreter.hpp"
+#include "optimizer.hpp"
+#include "precompute.hpp"
 #include "options.hpp"
 
-bool read_file(const char *filename, std::string &out) {
-    std::ifstream stream(filename, std::ios::in | std::ios::binary);
-    if (stream) {
-        stream.seekg(0, std::ios::end);
-        out.clear();
-        out.resize(std::size_t(stream.tellg()) + 1);
-        stream.seekg(0, std::ios::beg);
-        stream.read(reinterpret_cast<char*>(&out[0]), out.size()-1);
-        stream.close();
-
-        out[out.size()-1] = '\n';
-        return true;
-    }
-    return false;
-}
-
 // Something for the future:
 // std::tolower has many problems such as being UB outside ASCII range,
 // and doing an incorrect job for anything beyond ASCII. And being slow.
 // Pull in ICU to do the transformation correctly.
 
-bool compile_file(const char *filename, Program &out) {
+bool compile_file(const char *filename, Program &out, const Options &options) {
     std::string bytes{};
-    if (!read_file(filename, bytes)) {
+    if (!Compiler::read_source(filename, bytes)) {
         std::printf("Error: File \"%s\" does not exist\n", filename);
         return false;
     }
 
     std::string_view name{ filename, std::strlen(filename) };
-    return Compiler::compile(name, std::move(bytes), out);
+    return Compiler::compile(name, std::move(bytes), out, options);
 }
 
 int main(int argc, char **argv) {
@@ -49,7 +33,7 @@ int main(int argc, char **argv) {
     }
 
     auto prog = Program{};
-    if (!compile_file(opts.filename, prog)) {
+    if (!compile_file(opts.filename, prog, opts)) {
         return 1;
     }
 
@@ -58,7 +42,23 @@ int main(int argc, char **argv) {
         return 0;
     }
 
-    // Optimizer here
+    if (opts.optimize) {
+        Optimizer::optimize(prog, opts);
+    }
+
+    if (opts.memoize) {
+        u32 memoized = Optimizer::memoize(prog);
+        std::printf("Memoizing %u subroutine%s\n", memoized, memoized == 1 ? "" : "s");
+    }
+
+    // Benchmarks want the real thing, and precomputed output is text that can't be checked
+    if (opts.precompute && opts.benchmark_iterations == 1 && !opts.output_digest && !opts.expect_file.data()) {
+        auto result = Precomputation{};
+        if (Precompute::run(prog, opts, result)) {
+            print_precomputed(result);
+            return 0;
+        }
+    }
 
     auto runtime = Runtime{};
     if (!create_runtime(prog, runtime, opts)) {
@@ -0,0 +1,372 @@
+#include "memory.hpp"
+
+#include <utility>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#define HAS_MEMFD
+#endif
+
+// Clearing soft-dirty bits clears them for every page in the process, which would make
+// another Memory that relies on them miss its changes. So only one gets to at a time:
+// the one in here, and only while its `soft_dirty` is set.
+static std::atomic<const Memory *> soft_dirty_owner{ nullptr };
+
+static bool claim_soft_dirty(const Memory *memory) {
+    const Memory *expected = nullptr;
+    return soft_dirty_owner.compare_exchange_strong(expected, memory);
+}
+
+static void give_up_soft_dirty(const Memory *memory) {
+    const Memory *expected = memory;
+    soft_dirty_owner.compare_exchange_strong(expected, nullptr);
+}
+
+Memory::~Memory() {
+    release();
+}
+
+constexpr std::size_t HUGE_PAGE_SIZE = 2 << 20;
+
+Memory::Memory(Memory &&other) noexcept
+    : words(std::exchange(other.words, nullptr))
+    , num_words(std::exchange(other.num_words, 0))
+    , mapped_bytes(std::exchange(other.mapped_bytes, 0))
+    , huge(std::exchange(other.huge, false))
+    , backing_words(std::exchange(other.backing_words, 0))
+    , image(std::move(other.image))
+    , soft_dirty(std::exchange(other.soft_dirty, false)) {
+    if (soft_dirty) soft_dirty_owner.store(this);
+}
+
+Memory &Memory::operator=(Memory &&other) noexcept {
+    if (this != &other) {
+        release();
+        words = std::exchange(other.words, nullptr);
+        num_words = std::exchange(other.num_words, 0);
+        mapped_bytes = std::exchange(other.mapped_bytes, 0);
+        huge = std::exchange(other.huge, false);
+        backing_words = std::exchange(other.backing_words, 0);
+        image = std::move(other.image);
+        soft_dirty = std::exchange(other.soft_dirty, false);
+        if (soft_dirty) soft_dirty_owner.store(this);
+    }
+    return *this;
+}
+
+#ifndef _WIN32
+// Maps `bytes` (a multiple of HUGE_PAGE_SIZE) at a huge page aligned address, which
+// transparent huge pages need. Over-reserves and trims the excess off both ends.
+static void *map_huge_aligned(std::size_t bytes) {
+    constexpr int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+
+    std::size_t reserved = bytes + HUGE_PAGE_SIZE;
+    void *ptr = mmap(nullptr, reserved, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (ptr == MAP_FAILED) return nullptr;
+
+    auto start = reinterpret_cast<std::uintptr_t>(ptr);
+    auto aligned = (start + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    if (aligned > start) munmap(ptr, aligned - start);
+    if (aligned + bytes < start + reserved) munmap(reinterpret_cast<void *>(aligned + bytes), start + reserved - aligned - bytes);
+
+    return reinterpret_cast<void *>(aligned);
+}
+#endif
+
+bool Memory::allocate(std::size_t count, bool huge_pages, std::size_t min_capacity) {
+    release();
+    if (count == 0) return true;
+
+    // Fresh mappings are zeroed by the OS, page by page as they get touched
+    std::size_t bytes = std::max(count, min_capacity) * sizeof(i32);
+#ifdef _WIN32
+    // Committed memory on Windows is also only backed by physical pages on first touch.
+    // Large pages would need a privilege most users don't have, so `huge_pages` is ignored.
+    (void)huge_pages;
+    void *ptr = VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (ptr == nullptr) return false;
+#else
+    void *ptr = MAP_FAILED;
+    if (huge_pages) {
+        bytes = (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+#ifdef MAP_HUGETLB
+        // Only works if the administrator has reserved pages for hugetlbfs. No MAP_NORESERVE
+        // here: with it, the mapping succeeds regardless and touching it raises SIGBUS instead.
+        ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        huge = ptr != MAP_FAILED;
+#endif
+#ifdef MADV_HUGEPAGE
+        if (ptr == MAP_FAILED) {
+            if (void *aligned = map_huge_aligned(bytes)) {
+                ptr = aligned;
+                huge = madvise(ptr, bytes, MADV_HUGEPAGE) == 0;
+            }
+        }
+#endif
+    }
+
+    if (ptr == MAP_FAILED) {
+        ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (ptr == MAP_FAILED) return false;
+    }
+#endif
+
+    words = static_cast<i32 *>(ptr);
+    num_words = count;
+    mapped_bytes = bytes;
+    return true;
+}
+
+bool Memory::map(const MemoryImage &image) {
+    release();
+    if (image.num_words == 0) return true;
+
+#ifdef HAS_MEMFD
+    if (image.fd >= 0) {
+        std::size_t bytes = image.num_words * sizeof(i32);
+        void *ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, image.fd, 0);
+        if (ptr == MAP_FAILED) return false;
+
+        words = static_cast<i32 *>(ptr);
+        num_words = image.num_words;
+        mapped_bytes = bytes;
+        backing_words = image.num_initial;
+        return true;
+    }
+#endif
+
+    if (!allocate(image.num_words)) return false;
+    std::memcpy(words, image.initial.data(), image.initial.size() * sizeof(i32));
+    return true;
+}
+
+bool Memory::resize(std::size_t count) {
+    if (count > capacity()) return false;
+    num_words = count;
+    return true;
+}
+
+void Memory::release() {
+    if (words == nullptr) return;
+
+#ifdef _WIN32
+    VirtualFree(words, 0, MEM_RELEASE);
+#else
+    munmap(words, mapped_bytes);
+#endif
+
+    words = nullptr;
+    num_words = 0;
+    mapped_bytes = 0;
+    huge = false;
+    backing_words = 0;
+    image.clear();
+    if (soft_dirty) give_up_soft_dirty(this);
+    soft_dirty = false;
+}
+
+static std::size_t page_size() {
+#ifdef _WIN32
+    return 4096;
+#else
+    static const std::size_t size = std::size_t(sysconf(_SC_PAGESIZE));
+    return size;
+#endif
+}
+
+#ifndef _WIN32
+// Makes every page of the process look clean again. Only says whether the kernel took the
+// request; kernels without CONFIG_MEM_SOFT_DIRTY take it too and never mark anything.
+static bool clear_soft_dirty() {
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (fd < 0) return false;
+    bool ok = write(fd, "4", 1) == 1;
+    close(fd);
+    return ok;
+}
+
+// Reads the pagemap entries of `count` pages starting at `addr`, see
+// Documentation/admin-guide/mm/pagemap.rst in the kernel tree
+static bool read_pagemap(int fd, const void *addr, std::size_t count, std::uint64_t *out) {
+    auto offset = off_t(reinterpret_cast<std::uintptr_t>(addr) / page_size() * sizeof(std::uint64_t));
+    auto bytes = count * sizeof(std::uint64_t);
+    return pread(fd, out, bytes, offset) == ssize_t(bytes);
+}
+
+constexpr std::uint64_t PAGEMAP_SOFT_DIRTY = std::uint64_t(1) << 55;
+
+static bool is_soft_dirty(const void *addr) {
+    int fd = open("/proc/self/pagemap", O_RDONLY);
+    if (fd < 0) return false;
+    std::uint64_t entry = 0;
+    bool ok = read_pagemap(fd, addr, 1, &entry);
+    close(fd);
+    return ok && (entry & PAGEMAP_SOFT_DIRTY);
+}
+#endif
+
+void Memory::snapshot(std::size_t num_initialized) {
+    image.assign(words, words + std::min(num_initialized, num_words));
+
+    bool tracked = false;
+#ifndef _WIN32
+    // Check that writes really get tracked before relying on it
+    if (num_words > 0 && (soft_dirty || claim_soft_dirty(this)) && clear_soft_dirty()) {
+        volatile i32 *probe = words;
+        *probe = *probe;
+        tracked = is_soft_dirty(words) && clear_soft_dirty();
+    }
+#endif
+    soft_dirty = tracked;
+    if (!soft_dirty) give_up_soft_dirty(this);
+}
+
+void Memory::restore_page(std::size_t first_word) {
+    std::size_t count = std::min(page_size() / sizeof(i32), num_words - first_word);
+    std::size_t from_image = first_word < image.size() ? std::min(count, image.size() - first_word) : 0;
+
+    if (from_image > 0) std::memcpy(words + first_word, image.data() + first_word, from_image * sizeof(i32));
+    std::memset(words + first_word + from_image, 0, (count - from_image) * sizeof(i32));
+}
+
+bool Memory::discard_pages() {
+#ifdef _WIN32
+    return false;
+#else
+    // Dropped pages of a private mapping come back zero-filled, or from the file it maps.
+    // Pages that have been swapped out are dropped as well.
+    return madvise(words, mapped_bytes, MADV_DONTNEED) == 0;
+#endif
+}
+
+void Memory::restore() {
+    std::size_t words_per_page = page_size() / sizeof(i32);
+    std::size_t num_pages = (num_words + words_per_page - 1) / words_per_page;
+
+#ifndef _WIN32
+    if (soft_dirty) {
+        int fd = open("/proc/self/pagemap", O_RDONLY);
+        if (fd >= 0) {
+            std::uint64_t entries[512];
+            bool ok = true;
+            for (std::size_t first = 0; ok && first < num_pages; first += 512) {
+                std::size_t count = std::min<std::size_t>(512, num_pages - first);
+                ok = read_pagemap(fd, words + first * words_per_page, count, entries);
+                for (std::size_t i = 0; ok && i < count; ++i) {
+                    if (entries[i] & PAGEMAP_SOFT_DIRTY) restore_page((first + i) * words_per_page);
+                }
+            }
+            close(fd);
+
+            // The restore itself dirtied the pages again
+            if (ok && clear_soft_dirty()) return;
+        }
+        soft_dirty = false;
+        give_up_soft_dirty(this);
+    }
+#endif
+
+    // Without knowing which pages were written, start over from fresh ones. Pages the
+    // program never touched stay uncommitted that way, unlike with copying everything.
+    if (discard_pages()) {
+        std::memcpy(words, image.data(), image.size() * sizeof(i32));
+        if (backing_words > image.size()) {
+            std::memset(words + image.size(), 0, (backing_words - image.size()) * sizeof(i32));
+        }
+        return;
+    }
+
+    // No way to get fresh pages, so reset every one of them
+    for (std::size_t page = 0; page < num_pages; ++page) {
+        restore_page(page * words_per_page);
+    }
+}
+
+MemoryImage::~MemoryImage() {
+    release();
+}
+
+MemoryImage::MemoryImage(MemoryImage &&other) noexcept
+    : fd(std::exchange(other.fd, -1))
+    , num_words(std::exchange(other.num_words, 0))
+    , num_initial(std::exchange(other.num_initial, 0))
+    , initial(std::move(other.initial)) {}
+
+MemoryImage &MemoryImage::operator=(MemoryImage &&other) noexcept {
+    if (this != &other) {
+        release();
+        fd = std::exchange(other.fd, -1);
+        num_words = std::exchange(other.num_words, 0);
+        num_initial = std::exchange(other.num_initial, 0);
+        initial = std::move(other.initial);
+    }
+    return *this;
+}
+
+bool MemoryImage::create(std::span<const i32> words, std::size_t count) {
+    release();
+    words = words.first(std::min(words.size(), count));
+    num_words = count;
+    num_initial = words.size();
+
+#ifdef HAS_MEMFD
+    // The file is sparse: the zeroes after `words` take up no memory until written
+    fd = memfd_create("ttk91-image", MFD_CLOEXEC);
+    if (fd >= 0) {
+        bool ok = ftruncate(fd, off_t(count * sizeof(i32))) == 0;
+
+        auto bytes = std::as_bytes(words);
+        for (std::size_t written = 0; ok && written < bytes.size();) {
+            ssize_t n = pwrite(fd, bytes.data() + written, bytes.size() - written, off_t(written));
+            ok = n > 0;
+            if (ok) written += std::size_t(n);
+        }
+        if (ok) return true;
+
+        close(fd);
+        fd = -1;
+    }
+#endif
+
+    initial.assign(words.begin(), words.end());
+    return true;
+}
+
+void MemoryImage::release() {
+#ifdef HAS_MEMFD
+    if (fd >= 0) close(fd);
+#endif
+    fd = -1;
+    num_words = 0;
+    num_initial = 0;
+    initial.clear();
+}
+
+void Memory::zero() {
+    // The next program to get a pooled runtime mustn't see anything of the last one, so
+    // every page goes, not just the ones known to have been written
+    image.clear();
+    if (soft_dirty) give_up_soft_dirty(this);
+    soft_dirty = false;
+
+    if (discard_pages()) {
+        std::memset(words, 0, backing_words * sizeof(i32));
+        return;
+    }
+    // All of it, as a later resize() can bring words past size() into view
+    std::memset(words, 0, capacity() * sizeof(i32));
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <span>
+
+#include "types.hpp"
+
+class MemoryImage;
+
+// Zero-initialized array of words backed by an anonymous memory mapping. Pages are only
+// committed once touched, so reserving a large stack that the program barely uses costs
+// next to nothing, unlike zero-filling a std::vector.
+class Memory {
+public:
+    Memory() = default;
+    ~Memory();
+
+    Memory(Memory &&other) noexcept;
+    Memory &operator=(Memory &&other) noexcept;
+    Memory(const Memory &) = delete;
+    Memory &operator=(const Memory &) = delete;
+
+    // Replaces the contents with `num_words` zeroes. Returns false if the address space
+    // couldn't be reserved, in which case the memory is left empty.
+    //
+    // With `huge_pages`, tries to back the memory with 2 MiB pages to cut down on TLB
+    // misses: first from the hugetlbfs pool, then with transparent huge pages. Falls back
+    // to normal pages silently; see uses_huge_pages().
+    //
+    // Room is made for at least `min_capacity` words, so that resize() can grow the memory later.
+    bool allocate(std::size_t num_words, bool huge_pages = false, std::size_t min_capacity = 0);
+
+    // Replaces the contents with a private copy of `image`. Pages are shared with the image
+    // and every other copy of it until written, so this is cheap no matter the size.
+    bool map(const MemoryImage &image);
+
+    // Whether huge pages were requested successfully. For transparent huge pages this
+    // only means the kernel accepted the hint.
+    bool uses_huge_pages() const { return huge; }
+
+    // Remembers the current contents for restore(), where everything past the first
+    // `num_initialized` words is known to be zero. Changes made in between are tracked by
+    // page, with the kernel's soft-dirty bits where available. Otherwise the pages are
+    // handed back to the OS on restore() and the snapshot copied into fresh ones.
+    //
+    // Soft-dirty bits can only be cleared for the whole process at once, so only one
+    // Memory at a time tracks changes with them; the others take the fallback. Anything
+    // else in the process that writes /proc/self/clear_refs breaks the tracking.
+    void snapshot(std::size_t num_initialized);
+
+    // Brings back the contents from the last snapshot(). With soft-dirty tracking, only the
+    // pages that changed are copied, so this costs about as much as the program touched,
+    // not the whole size.
+    void restore();
+
+    // Back to all zeroes, for reusing the memory. The pages are handed back to the OS
+    // where possible, so this doesn't commit the ones the program never used.
+    void zero();
+
+    i32 *data() { return words; }
+    const i32 *data() const { return words; }
+    std::size_t size() const { return num_words; }
+
+    // Words that fit in the mapping, which can be more than size()
+    std::size_t capacity() const { return mapped_bytes / sizeof(i32); }
+
+    // Changes size() without mapping anything, up to capacity(). Meant for memory that is all
+    // zeroes (see zero()), so the words that come into view read as zero too. Returns false
+    // if they don't fit.
+    bool resize(std::size_t num_words);
+
+    i32 &operator[](std::size_t idx) { return words[idx]; }
+    const i32 &operator[](std::size_t idx) const { return words[idx]; }
+
+private:
+    void release();
+    void restore_page(std::size_t first_word);
+
+    // Drops every page, so that the memory reads as it did right after allocate() or map():
+    // zeroes past the first `backing_words`, and whatever the image had before that.
+    // Returns false if the OS wouldn't do it, leaving the contents as they were.
+    bool discard_pages();
+
+    i32 *words = nullptr;
+    std::size_t num_words = 0;
+    std::size_t mapped_bytes = 0;
+    bool huge = false;
+    std::size_t backing_words = 0; // words that come from a MemoryImage when a page is dropped
+
+    std::vector<i32> image; // the snapshot, without the zeroes at the end
+    bool soft_dirty = false;
+};
+
+// Initial contents for any number of Memory instances, see Memory::map(). On Linux the
+// words live in a memfd that the instances map copy-on-write. Elsewhere they are
+// simply copied.
+class MemoryImage {
+public:
+    MemoryImage() = default;
+    ~MemoryImage();
+
+    MemoryImage(MemoryImage &&other) noexcept;
+    MemoryImage &operator=(MemoryImage &&other) noexcept;
+    MemoryImage(const MemoryImage &) = delete;
+    MemoryImage &operator=(const MemoryImage &) = delete;
+
+    // Makes an image of `num_words` words that start out as `words`, zeroes after that
+    bool create(std::span<const i32> words, std::size_t num_words);
+
+    std::size_t size() const { return num_words; }
+
+private:
+    friend class Memory;
+
+    void release();
+
+    int fd = -1;
+    std::size_t num_words = 0;
+    std::size_t num_initial = 0; // words past these are zero
+    std::vector<i32> initial; // without memfd
+};
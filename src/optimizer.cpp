@@ -0,0 +1,1750 @@
+#include "optimizer.hpp"
+
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <bit>
+
+#include "tsl/robin_map.h"
+#include "tsl/robin_set.h"
+
+#include "types.hpp"
+#include "instructions.hpp"
+#include "interpreter.hpp" // STACK_GUARD_WORDS
+
+static InstructionType opcode_of(u32 ins) { return InstructionType(decode_opcode(ins)); }
+
+static u32 make_instruction(InstructionType type, Register dst, Register src, AddressMode addrm, i32 value) {
+    return encode_opcode(type)
+        | encode_dst(dst)
+        | encode_src(src)
+        | encode_addrm(addrm)
+        | encode_value(i16(value));
+}
+
+// The passes work on the full value of every instruction, which the instruction itself
+// only has room for when it fits in 16 bits (see Program::wide_operands). So the full
+// values are filled in for the duration even when they all fit, and dropped after.
+static void widen_operands(Program &program) {
+    if (!program.wide_operands.empty()) return;
+    program.wide_operands.reserve(program.instructions.size());
+    for (u32 ins : program.instructions) program.wide_operands.push_back(decode_value(ins));
+}
+
+static void narrow_operands(Program &program) {
+    for (i32 value : program.wide_operands) {
+        if (value != i16(value)) return;
+    }
+    program.wide_operands.clear();
+}
+
+// Whether the instruction reads or writes memory at `value + src`.
+// STORE is special because its address mode is shifted down by one (see parse_store()).
+static bool accesses_memory(u32 ins) {
+    auto addrm = AddressMode(decode_addrm(ins));
+    if (opcode_of(ins) == InstructionType::STORE) return addrm != AddressMode::IMMEDIATE;
+    return addrm == AddressMode::DIRECT || addrm == AddressMode::INDIRECT;
+}
+
+// Whether the instruction also accesses memory at an address it loaded from memory,
+// which is impossible to reason about statically.
+static bool accesses_memory_indirectly(u32 ins) {
+    auto addrm = AddressMode(decode_addrm(ins));
+    if (opcode_of(ins) == InstructionType::STORE) return addrm == AddressMode::DIRECT;
+    return addrm == AddressMode::INDIRECT;
+}
+
+static bool writes_dst_register(InstructionType type) {
+    switch (type) {
+        case InstructionType::LOAD: case InstructionType::IN:
+        case InstructionType::ADD: case InstructionType::SUB: case InstructionType::MUL:
+        case InstructionType::DIV: case InstructionType::MOD:
+        case InstructionType::AND: case InstructionType::OR: case InstructionType::XOR:
+        case InstructionType::NOT: case InstructionType::SHL: case InstructionType::SHR:
+        case InstructionType::SHRA:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool is_stack_register(Register reg) {
+    return reg == Register::SP || reg == Register::FP;
+}
+
+// Instructions whose value is the index of another instruction
+static bool is_call(InstructionType type) {
+    return type == InstructionType::CALL || type == InstructionType::EXT_TAILCALL;
+}
+
+static bool is_jump(InstructionType type) {
+    return (type >= InstructionType::JUMP && type <= InstructionType::JNGRE) || is_call(type);
+}
+
+static bool is_conditional_jump(InstructionType type) {
+    return is_jump(type) && type != InstructionType::JUMP && !is_call(type);
+}
+
+// Control flow within a subroutine: calls continue at the next instruction like any
+// other, and EXIT and HALT lead nowhere.
+template<typename Fn>
+static void local_successors(const std::vector<u32> &code, const std::vector<i32> &values, u32 idx, Fn &&out) {
+    using T = InstructionType;
+
+    auto type = opcode_of(code[idx]);
+    if (type == T::EXIT || type == T::EXT_HALT) return;
+    if (is_jump(type) && !is_call(type) && u32(values[idx]) < code.size()) out(u32(values[idx]));
+    if (type != T::JUMP && idx + 1 < code.size()) out(idx + 1);
+}
+
+static u32 with_opcode(u32 ins, InstructionType type) {
+    return ins - encode_opcode(opcode_of(ins)) + encode_opcode(type);
+}
+
+static u32 with_value(u32 ins, i32 value) {
+    return (ins & ~encode_value(i16((1 << VALUE_BITS) - 1))) | encode_value(i16(value));
+}
+
+// The compiler-generated HALT at the very end has no source line
+static u32 line_of(const Program &program, u32 instruction_idx, u32 fallback) {
+    if (instruction_idx < program.instr_idx_to_line_idx.size()) return program.instr_idx_to_line_idx[instruction_idx];
+    return fallback;
+}
+
+// A subroutine body prepared for splicing into a call site. Jump targets in `code`
+// are relative to the start of the body, and `code.size()` is where it returns to.
+struct InlineBody {
+    std::vector<u32> code;
+    std::vector<i32> values;     // full values of `code`
+    std::vector<u32> source_idx; // index of the original instruction each one came from
+};
+
+// What a small leaf subroutine looks like to inline_subroutines(), independent of the call site
+struct InlineCandidate {
+    std::vector<u32> body; // indices of its instructions, in order
+    i32 num_params;        // what its EXITs clean up
+    bool stores_result;    // writes to its return slot, right below the parameters
+    bool saves_registers;  // starts with PUSHR, so R0-R5 are back to what they were when it returns
+    u32 written_regs;      // R0-R5 written anywhere, not counting POPR
+    u32 entry_live_regs;   // R0-R5 that may be read before being written
+    u32 regs_after_result; // R0-R5 used after storing the result
+};
+
+// Stack state at a callee instruction, relative to the state right after CALL
+struct FrameState {
+    i32 delta;      // words pushed since entry
+    i32 pushr_base; // delta before the active PUSHR, or -1 if none
+    bool stored;    // the result has been stored on the way here
+};
+
+constexpr u32 ALL_GENERAL_REGISTERS = (1 << (u32(Register::R5) + 1)) - 1; // R0-R5
+
+static u32 register_bit(Register reg) {
+    return u32(reg) <= u32(Register::R5) ? 1 << u32(reg) : 0;
+}
+
+// Which of R0-R5 an instruction reads and writes
+struct RegisterEffects {
+    u32 reads;
+    u32 writes;
+};
+
+static RegisterEffects register_effects(u32 ins) {
+    auto type = opcode_of(ins);
+    u32 dst = register_bit(Register(decode_dst(ins)));
+    u32 src = register_bit(Register(decode_src(ins)));
+    bool reads_src = AddressMode(decode_addrm(ins)) != AddressMode::IMMEDIATE && type != InstructionType::POP;
+
+    auto effects = RegisterEffects{ .reads = reads_src ? src : 0, .writes = 0 };
+    switch (type) {
+        case InstructionType::LOAD: case InstructionType::IN: effects.writes = dst; break;
+        case InstructionType::POP: effects.writes = src; break;
+        case InstructionType::PUSHR: effects.reads = ALL_GENERAL_REGISTERS; break;
+        case InstructionType::POPR: effects.writes = ALL_GENERAL_REGISTERS; break;
+        case InstructionType::JUMP: break;
+        default:
+            if (writes_dst_register(type)) effects.writes = dst;
+            // The COMP-based jumps have no register operand
+            bool reads_dst = type != InstructionType::PUSH && type != InstructionType::SVC
+                && !(type >= InstructionType::JLES && type <= InstructionType::JNGRE);
+            if (reads_dst) effects.reads |= dst;
+            break;
+    }
+    return effects;
+}
+
+// Which of R0-R5 may still be read after falling through to `start`. Only looks at
+// straight-line code; anything still undecided at the first jump is assumed live.
+static u32 live_registers_at(const Program &program, u32 start) {
+    u32 live = 0, decided = 0;
+
+    for (u32 idx = start; idx < program.instructions.size(); ++idx) {
+        u32 ins = program.instructions[idx];
+        auto type = opcode_of(ins);
+        if (type == InstructionType::EXT_HALT) return live;
+
+        auto [reads, writes] = register_effects(ins);
+        live |= reads & ~decided;
+        decided |= reads | writes;
+
+        if (is_jump(type) || type == InstructionType::EXIT) break;
+    }
+
+    return live | (ALL_GENERAL_REGISTERS & ~decided);
+}
+
+// Works out whether the subroutine at `entry` is a small leaf subroutine that follows
+// the calling convention closely enough to be inlined: the frame is only used for
+// reading parameters and storing the result, the stack is balanced on every path to
+// EXIT, and PUSHR/POPR (if any) surround the whole body.
+static bool analyze_inline_candidate(const Program &program, u32 entry, u32 threshold, InlineCandidate &out) {
+    const auto &code = program.instructions;
+    const auto &values = program.wide_operands;
+    const u32 size = u32(code.size());
+    using T = InstructionType;
+
+    auto states = tsl::robin_map<u32, FrameState>{};
+    states[entry] = FrameState{ .delta = 0, .pushr_base = -1, .stored = false };
+    auto worklist = std::vector<u32>{ entry };
+
+    auto param_reads = std::vector<u32>{};
+    auto result_stores = std::vector<u32>{};
+    i32 num_params = -1;
+    bool stored_at_every_exit = true;
+
+    out = InlineCandidate{};
+
+    auto visit = [&](u32 target, FrameState state) {
+        if (target >= size) return false;
+        auto [it, inserted] = states.emplace(target, state);
+        if (inserted) {
+            worklist.push_back(target);
+            return true;
+        }
+        const FrameState &seen = it->second;
+        return seen.delta == state.delta && seen.pushr_base == state.pushr_base && seen.stored == state.stored;
+    };
+
+    while (!worklist.empty()) {
+        u32 idx = worklist.back();
+        worklist.pop_back();
+
+        if (states.size() > threshold) return false;
+
+        u32 ins = code[idx];
+        auto type = opcode_of(ins);
+        auto dst = Register(decode_dst(ins));
+        auto src = Register(decode_src(ins));
+        auto addrm = AddressMode(decode_addrm(ins));
+        FrameState state = states[idx];
+        FrameState next = state;
+
+        // SP/FP may only appear as the stack operand of the stack instructions,
+        // or as the base of a parameter or result access.
+        switch (type) {
+            case T::PUSH: case T::POP: case T::PUSHR: case T::POPR:
+            case T::EXIT: case T::SVC: case T::EXT_HALT:
+                break;
+            default:
+                if (is_stack_register(dst)) return false;
+        }
+
+        if (type == T::POP) {
+            if (is_stack_register(src)) return false;
+        } else if (type == T::STORE && src == Register::FP) {
+            if (addrm != AddressMode::REGISTER) return false; // through a pointer in the frame
+            result_stores.push_back(idx);
+            next.stored = true;
+        } else if (addrm != AddressMode::IMMEDIATE && is_stack_register(src)) {
+            if (src == Register::SP || addrm != AddressMode::DIRECT || values[idx] > -2) return false;
+            param_reads.push_back(idx);
+        }
+
+        // PUSHR/POPR are dropped from inlined copies, see inline_subroutines()
+        if (type != T::PUSHR && type != T::POPR) {
+            auto [reads, writes] = register_effects(ins);
+            out.written_regs |= writes;
+            if (state.stored) out.regs_after_result |= reads | writes;
+        }
+
+        switch (type) {
+            case T::CALL: case T::EXT_TAILCALL:
+                return false; // not a leaf
+            case T::PUSH:
+                next.delta += 1;
+                break;
+            case T::POP:
+                next.delta -= 1;
+                if (next.delta < 0 || (next.pushr_base >= 0 && next.delta < next.pushr_base + 6)) return false;
+                break;
+            case T::PUSHR:
+                if (idx != entry) return false;
+                next.pushr_base = state.delta;
+                next.delta += 6;
+                break;
+            case T::POPR:
+                if (state.pushr_base < 0 || state.delta != state.pushr_base + 6) return false;
+                if (idx + 1 >= size || opcode_of(code[idx + 1]) != T::EXIT) return false;
+                next.pushr_base = -1;
+                next.delta -= 6;
+                break;
+            case T::EXIT:
+                if (state.delta != 0 || state.pushr_base >= 0) return false;
+                if (num_params >= 0 && num_params != values[idx]) return false;
+                num_params = values[idx];
+                stored_at_every_exit &= state.stored;
+                continue;
+            case T::EXT_HALT:
+                continue;
+            default:
+                break;
+        }
+
+        if (is_jump(type)) {
+            if (!visit(u32(values[idx]), next)) return false;
+            if (!is_conditional_jump(type)) continue;
+        }
+        if (!visit(idx + 1, next)) return false;
+    }
+
+    if (num_params < 0) return false;
+    for (u32 idx : param_reads) {
+        if (values[idx] < -1 - num_params) return false; // the result slot or further
+    }
+    for (u32 idx : result_stores) {
+        if (values[idx] != -2 - num_params) return false;
+    }
+    if (!result_stores.empty() && !stored_at_every_exit) return false;
+
+    out.num_params = num_params;
+    out.stores_result = !result_stores.empty();
+    out.saves_registers = opcode_of(code[entry]) == T::PUSHR;
+    for (const auto &entry : states) out.body.push_back(entry.first);
+    std::sort(out.body.begin(), out.body.end());
+
+    // Registers that may still hold the caller's values when read: what has been
+    // written for sure on the way to each instruction, intersected where paths meet.
+    auto position = tsl::robin_map<u32, u32>{};
+    for (u32 i = 0; i < out.body.size(); ++i) position[out.body[i]] = i;
+    auto written = std::vector<u32>(out.body.size(), ALL_GENERAL_REGISTERS);
+    written[position[entry]] = 0;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (u32 i = 0; i < out.body.size(); ++i) {
+            u32 idx = out.body[i];
+            auto type = opcode_of(code[idx]);
+            if (type == T::EXIT || type == T::EXT_HALT) continue;
+
+            u32 after = written[i];
+            if (type != T::PUSHR && type != T::POPR) after |= register_effects(code[idx]).writes;
+            auto flow = [&](u32 succ) {
+                auto it = position.find(succ);
+                if (it == position.end() || (written[it->second] & after) == written[it->second]) return;
+                written[it->second] &= after;
+                changed = true;
+            };
+            if (is_jump(type)) flow(u32(values[idx]));
+            if (type != T::JUMP) flow(idx + 1);
+        }
+    }
+    for (u32 i = 0; i < out.body.size(); ++i) {
+        auto type = opcode_of(code[out.body[i]]);
+        if (type == T::PUSHR || type == T::POPR) continue;
+        out.entry_live_regs |= register_effects(code[out.body[i]]).reads & ~written[i];
+    }
+    return true;
+}
+
+// How a particular call site passes its arguments and takes the result
+struct InlineSite {
+    u32 call;                                // index of the CALL
+    u32 start, end;                          // instructions replaced by the body
+    Register result;                         // where the result is popped to, if stores_result
+    std::array<Register, REGISTER_FILE_SIZE> renamed; // registers of the callee in the copy
+};
+
+// Builds the copy of `callee` that replaces the call sequence of `site`.
+//
+// The frame is elided altogether. Parameters are read straight from the operands
+// that were pushed for them, storing the result becomes a LOAD into the register
+// the caller would have popped it to, and EXIT becomes a jump to the end of the body.
+// PUSHR/POPR are dropped: registers that the caller still needs are renamed instead.
+static void build_inline_body(const Program &program, const InlineCandidate &callee, const InlineSite &site, InlineBody &out) {
+    const auto &code = program.instructions;
+    const auto &values = program.wide_operands;
+    using T = InstructionType;
+
+    u32 last = callee.body.back();
+    auto emitted_length = [&](u32 idx) {
+        switch (opcode_of(code[idx])) {
+            case T::PUSHR: case T::POPR: return 0;
+            case T::EXIT: return i32(idx != last);
+            default: return 1;
+        }
+    };
+
+    // First pass: where each original instruction starts in the body
+    auto body_start = tsl::robin_map<u32, i32>{};
+    i32 length = 0;
+    for (u32 idx : callee.body) {
+        body_start[idx] = length;
+        length += emitted_length(idx);
+    }
+
+    auto emit = [&](u32 ins, i32 value, u32 source) {
+        out.code.push_back(ins);
+        out.values.push_back(value);
+        out.source_idx.push_back(source);
+    };
+
+    for (u32 idx : callee.body) {
+        u32 ins = code[idx];
+        auto type = opcode_of(ins);
+        auto dst = site.renamed[decode_dst(ins)];
+        auto src = site.renamed[decode_src(ins)];
+        auto addrm = AddressMode(decode_addrm(ins));
+        i32 value = values[idx];
+
+        if (type == T::PUSHR || type == T::POPR) continue;
+        if (type == T::EXIT) {
+            if (idx != last) emit(make_instruction(T::JUMP, Register::R0, Register::EXT_ZR, AddressMode::IMMEDIATE, length), length, idx);
+            continue;
+        }
+
+        if (type == T::STORE && Register(decode_src(ins)) == Register::FP) {
+            emit(make_instruction(T::LOAD, site.result, dst, AddressMode::REGISTER, 0), 0, idx);
+            continue;
+        }
+
+        if (type != T::POP && addrm != AddressMode::IMMEDIATE && Register(decode_src(ins)) == Register::FP) {
+            // Parameters are at FP-2 and down, in reverse order of pushing
+            u32 push = u32(i32(site.call) + 1 + value);
+            value = values[push];
+            src = Register(decode_src(code[push]));
+            addrm = AddressMode(decode_addrm(code[push]));
+        } else if (is_jump(type)) {
+            value = body_start[u32(value)];
+        }
+        emit(make_instruction(type, dst, src, addrm, value) | (ins & encode_bounds_proven(true)), value, idx);
+    }
+}
+
+// Splices small leaf subroutines into their call sites, PUSHes of the arguments and
+// POP of the result included.
+//
+// Registers that a callee starting with PUSHR writes are renamed to ones that no other
+// instruction in the program uses when the caller still needs them after the call, or
+// when an argument is read from them. Call sites that would need more of those than
+// there are, push arguments from memory or with something else in between aren't inlined.
+static u32 inline_subroutines(Program &program, u32 threshold) {
+    if (threshold == 0) return 0;
+
+    const auto &code = program.instructions;
+    const auto &values = program.wide_operands;
+    const u32 size = u32(code.size());
+    using T = InstructionType;
+
+    for (u32 idx = 0; idx < size; ++idx) {
+        if (is_jump(opcode_of(code[idx])) && (values[idx] < 0 || u32(values[idx]) > size)) {
+            return 0; // relocating a broken jump would only make things more confusing
+        }
+    }
+
+    auto jump_targets = std::vector<bool>(size + 1, false);
+    u32 used_regs = 0;
+    for (u32 idx = 0; idx < size; ++idx) {
+        auto type = opcode_of(code[idx]);
+        if (is_jump(type)) jump_targets[u32(values[idx])] = true;
+        if (type != T::PUSHR && type != T::POPR) {
+            auto [reads, writes] = register_effects(code[idx]);
+            used_regs |= reads | writes;
+        }
+    }
+    // R0 is left out, to keep it meaning zero wherever it is used as a base register
+    u32 free_regs = ALL_GENERAL_REGISTERS & ~used_regs & ~register_bit(Register::R0);
+
+    auto candidates = tsl::robin_map<u32, InlineCandidate>{};
+    auto rejected = tsl::robin_set<u32>{};
+    auto candidate_at = [&](u32 target) -> const InlineCandidate* {
+        if (rejected.contains(target)) return nullptr;
+        if (auto it = candidates.find(target); it != candidates.end()) return &it->second;
+
+        auto candidate = InlineCandidate{};
+        if (!analyze_inline_candidate(program, target, threshold, candidate)) {
+            rejected.insert(target);
+            return nullptr;
+        }
+        return &(candidates[target] = std::move(candidate));
+    };
+
+    // An argument or the result slot, pushed right before the call without touching memory
+    auto is_plain_push = [&](u32 idx) {
+        u32 ins = code[idx];
+        auto addrm = AddressMode(decode_addrm(ins));
+        if (opcode_of(ins) != T::PUSH || Register(decode_dst(ins)) != Register::SP) return false;
+        if (addrm == AddressMode::IMMEDIATE) return true;
+        return addrm == AddressMode::REGISTER && register_bit(Register(decode_src(ins))) != 0;
+    };
+
+    auto sites = std::vector<InlineSite>{};
+    auto bodies = std::vector<InlineBody>{};
+    u32 next_free = 0; // sites can't overlap
+    for (u32 idx = 0; idx < size; ++idx) {
+        if (opcode_of(code[idx]) != T::CALL || u32(values[idx]) >= size) continue;
+
+        const InlineCandidate *callee = candidate_at(u32(values[idx]));
+        if (!callee) continue;
+
+        auto site = InlineSite{ .call = idx, .start = idx, .end = idx + 1, .result = Register::R0, .renamed = {} };
+        u32 n = u32(callee->num_params) + callee->stores_result;
+        if (idx < next_free + n) continue;
+        site.start = idx - n;
+
+        bool plain = true;
+        for (u32 i = site.start; i < idx; ++i) plain &= is_plain_push(i);
+        for (u32 i = site.start + 1; i <= idx; ++i) plain &= !jump_targets[i];
+        if (!plain) continue;
+
+        u32 live = 0;
+        if (callee->stores_result) {
+            u32 pop = idx + 1 < size ? code[idx + 1] : 0;
+            if (idx + 1 >= size || opcode_of(pop) != T::POP || Register(decode_dst(pop)) != Register::SP) continue;
+            if (register_bit(Register(decode_src(pop))) == 0 || jump_targets[idx + 1]) continue;
+
+            site.result = Register(decode_src(pop));
+            site.end = idx + 2;
+            live = live_registers_at(program, idx + 2) & ~register_bit(site.result);
+            if (callee->regs_after_result & register_bit(site.result)) continue;
+        } else {
+            live = live_registers_at(program, idx + 1);
+        }
+
+        u32 arg_regs = 0;
+        for (u32 i = site.start + callee->stores_result; i < idx; ++i) arg_regs |= register_bit(Register(decode_src(code[i])));
+        if (callee->stores_result && (arg_regs & register_bit(site.result))) continue;
+
+        // Without PUSHR, the caller sees what the callee leaves in the registers
+        u32 to_rename = callee->written_regs & arg_regs;
+        if (callee->saves_registers) to_rename |= callee->written_regs & live;
+        else if (to_rename) continue;
+        if (to_rename & callee->entry_live_regs) continue;
+        if (std::popcount(to_rename) > std::popcount(free_regs)) continue;
+
+        for (u32 r = 0; r < site.renamed.size(); ++r) site.renamed[r] = Register(r);
+        u32 spare = free_regs;
+        for (u32 r = 0; r <= u32(Register::R5); ++r) {
+            if (!((to_rename >> r) & 1)) continue;
+            site.renamed[r] = Register(std::countr_zero(spare));
+            spare &= spare - 1;
+        }
+
+        auto body = InlineBody{};
+        build_inline_body(program, *callee, site, body);
+
+        // Inlining has to pay for itself
+        if (body.code.size() >= (site.end - site.start) + callee->body.size()) continue;
+
+        sites.push_back(site);
+        bodies.push_back(std::move(body));
+        next_free = site.end;
+    }
+
+    if (sites.empty()) return 0;
+
+    // Compute the new position of every instruction. Replaced instructions lead to the body.
+    auto new_idx = std::vector<u32>(size + 1);
+    u32 new_size = 0;
+    for (u32 idx = 0, s = 0; idx < size; ++idx) {
+        new_idx[idx] = new_size;
+        if (s < sites.size() && idx >= sites[s].start) {
+            if (idx + 1 == sites[s].end) new_size += u32(bodies[s++].code.size());
+            continue;
+        }
+        new_size += 1;
+    }
+    new_idx[size] = new_size;
+
+    auto new_code = std::vector<u32>{};
+    auto new_values = std::vector<i32>{};
+    auto new_lines = std::vector<u32>{};
+    new_code.reserve(new_size);
+    new_values.reserve(new_size);
+    new_lines.reserve(new_size);
+
+    for (u32 idx = 0, s = 0; idx < size; ++idx) {
+        u32 ins = code[idx];
+        i32 value = values[idx];
+
+        if (s < sites.size() && idx >= sites[s].start) {
+            if (idx + 1 != sites[s].end) continue;
+
+            const InlineBody &body = bodies[s];
+            u32 call_line = line_of(program, sites[s].call, 0);
+            for (std::size_t i = 0; i < body.code.size(); ++i) {
+                u32 copy = body.code[i];
+                i32 copy_value = body.values[i];
+                if (is_jump(opcode_of(copy))) {
+                    copy_value += i32(new_idx[sites[s].start]);
+                    copy = with_value(copy, copy_value);
+                }
+
+                new_code.push_back(copy);
+                new_values.push_back(copy_value);
+                new_lines.push_back(line_of(program, body.source_idx[i], call_line));
+            }
+            s += 1;
+            continue;
+        }
+
+        if (is_jump(opcode_of(ins))) {
+            value = i32(new_idx[value]);
+            ins = with_value(ins, value);
+        }
+        new_code.push_back(ins);
+        new_values.push_back(value);
+        if (idx < program.instr_idx_to_line_idx.size()) new_lines.push_back(program.instr_idx_to_line_idx[idx]);
+    }
+
+    program.instructions = std::move(new_code);
+    program.wide_operands = std::move(new_values);
+    program.instr_idx_to_line_idx = std::move(new_lines);
+    return u32(sites.size());
+}
+
+// Whether every EXIT the subroutine at `entry` reaches comes right after storing `reg`
+// to its return slot, so that `reg` holds the result whenever it returns. Tail calls
+// that pass the result on (see convert_tail_calls()) are fine as long as they are
+// back to the same subroutine.
+static bool returns_result_in(const Program &program, const std::vector<bool> &jump_targets, u32 entry, Register reg) {
+    const auto &code = program.instructions;
+    const auto &values = program.wide_operands;
+    using T = InstructionType;
+
+    auto visited = tsl::robin_set<u32>{ entry };
+    auto worklist = std::vector<u32>{ entry };
+    while (!worklist.empty()) {
+        u32 idx = worklist.back();
+        worklist.pop_back();
+
+        u32 ins = code[idx];
+        if (opcode_of(ins) == T::EXT_TAILCALL) {
+            if (decode_src(ins) == 0 || u32(values[idx]) != entry) return false;
+            if (Register(decode_src(code[idx + 1])) != reg) return false;
+        }
+        if (opcode_of(ins) == T::EXIT) {
+            if (idx == 0 || jump_targets[idx]) return false;
+            u32 store = code[idx - 1];
+            if (opcode_of(store) != T::STORE || Register(decode_dst(store)) != reg) return false;
+            if (Register(decode_src(store)) != Register::FP || AddressMode(decode_addrm(store)) != AddressMode::REGISTER) return false;
+            if (values[idx - 1] != -2 - values[idx]) return false;
+        }
+
+        local_successors(code, values, idx, [&](u32 succ) {
+            if (visited.insert(succ).second) worklist.push_back(succ);
+        });
+    }
+    return true;
+}
+
+// Turns `CALL f` directly followed by `EXIT` into EXT_TAILCALL, which reuses the
+// current frame for the callee (see Lop_tailcall). A JUMP that leads to an EXIT is
+// first replaced with a copy of that EXIT, so calls in tail position that branch to
+// a shared epilogue are caught as well.
+//
+// Subroutines that return their result in a stack slot usually end with
+// `CALL f; POP SP, Rx; STORE Rx, Ret(FP); EXIT`, which copies f's result into their
+// own return slot. If f always leaves its result in Rx as well, that becomes an
+// EXT_TAILCALL with src 1, which hands f the caller's return slot to write to.
+// This is what makes accumulator-style recursion run in constant stack space.
+static u32 convert_tail_calls(Program &program) {
+    auto &code = program.instructions;
+    auto &values = program.wide_operands;
+    const u32 size = u32(code.size());
+    using T = InstructionType;
+
+    auto jump_targets = std::vector<bool>(size, false);
+    for (u32 idx = 0; idx < size; ++idx) {
+        if (is_jump(opcode_of(code[idx])) && u32(values[idx]) < size) jump_targets[u32(values[idx])] = true;
+    }
+
+    auto final_target = [&](u32 idx) {
+        // Bounded to not loop forever on `L JUMP L`
+        for (u32 hops = 0; hops < 16 && idx < size && opcode_of(code[idx]) == InstructionType::JUMP; ++hops) {
+            idx = u32(values[idx]);
+        }
+        return idx;
+    };
+
+    auto tail_call = [&](u32 idx, bool passes_result) {
+        auto dst = Register(decode_dst(code[idx]));
+        auto src = Register(passes_result ? 1 : 0);
+        code[idx] = make_instruction(T::EXT_TAILCALL, dst, src, AddressMode::IMMEDIATE, values[idx]);
+    };
+
+    u32 converted = 0;
+    for (u32 idx = 0; idx + 1 < size; ++idx) {
+        if (opcode_of(code[idx]) != T::CALL) continue;
+
+        u32 next = final_target(idx + 1);
+        if (next < size && opcode_of(code[next]) == T::EXIT) {
+            code[idx + 1] = code[next];
+            values[idx + 1] = values[next];
+            tail_call(idx, false);
+            converted += 1;
+            continue;
+        }
+
+        if (idx + 3 >= size) continue;
+        u32 pop = code[idx + 1];
+        u32 store = code[idx + 2];
+        auto reg = Register(decode_src(pop));
+        if (opcode_of(pop) != T::POP || Register(decode_dst(pop)) != Register::SP || is_stack_register(reg)) continue;
+        if (opcode_of(store) != T::STORE || Register(decode_dst(store)) != reg) continue;
+        if (Register(decode_src(store)) != Register::FP || AddressMode(decode_addrm(store)) != AddressMode::REGISTER) continue;
+
+        next = final_target(idx + 3);
+        if (next >= size || opcode_of(code[next]) != T::EXIT || values[idx + 2] != -2 - values[next]) continue;
+        if (u32(values[idx]) >= size || !returns_result_in(program, jump_targets, u32(values[idx]), reg)) continue;
+
+        code[idx + 3] = code[next];
+        values[idx + 3] = values[next];
+        tail_call(idx, true);
+        converted += 1;
+    }
+    return converted;
+}
+
+//
+// Loop idioms
+//
+
+// Whether `ins` (with the full value `value`) is `ADD reg, =1`
+static bool is_increment_of(u32 ins, i32 value, Register reg) {
+    return opcode_of(ins) == InstructionType::ADD
+        && AddressMode(decode_addrm(ins)) == AddressMode::IMMEDIATE
+        && Register(decode_dst(ins)) == reg
+        && value == 1;
+}
+
+// Whether `ins` is `COMP reg, =N` or `COMP reg, N(Rn)` (N may be 0) with Rn untouched by the loop
+static bool is_loop_bound_check(u32 ins, Register reg, Register written) {
+    if (opcode_of(ins) != InstructionType::COMP || Register(decode_dst(ins)) != reg) return false;
+
+    auto addrm = AddressMode(decode_addrm(ins));
+    auto src = Register(decode_src(ins));
+    if (addrm == AddressMode::IMMEDIATE) return true;
+    return addrm == AddressMode::REGISTER && src != reg && src != written && src != Register::SP;
+}
+
+static bool is_loop_back_jump(u32 ins, i32 value, u32 head) {
+    auto type = opcode_of(ins);
+    return (type == InstructionType::JLES || type == InstructionType::JNGRE)
+        && AddressMode(decode_addrm(ins)) == AddressMode::IMMEDIATE
+        && u32(value) == head;
+}
+
+// Indices into an array must come from a register the loop can own
+static bool is_index_register(Register reg) {
+    return u32(reg) <= u32(Register::R5);
+}
+
+// Replaces the first instruction of loops that fill, copy or sum an array with a bulk
+// opcode that runs the whole loop at once. Recognized shapes, with Ri counting up by one:
+//
+//   fill: STORE Rv, A(Ri)                   sum: ADD Rs, A(Ri)
+//         ADD Ri, =1                             ADD Ri, =1
+//         COMP Ri, =N (or N(Rn))                 COMP Ri, =N
+//         JLES <fill> (or JNGRE)                 JLES <sum>
+//
+//   copy: LOAD Rt, A(Ri)
+//         STORE Rt, B(Ri)
+//         ...
+//
+// The rest of the loop is left in place: the bulk opcodes read it to find the bound,
+// and fall back to executing the original instruction when they can't run the loop in
+// one go (see Lop_fill and friends in interpreter.cpp). Must run after every other
+// pass, as none of them know about the bulk opcodes.
+static u32 recognize_loop_idioms(Program &program) {
+    using T = InstructionType;
+
+    auto &code = program.instructions;
+    const auto &values = program.wide_operands;
+    const u32 size = u32(code.size());
+
+    u32 recognized = 0;
+    for (u32 head = 0; head + 3 < size; ++head) {
+        u32 ins = code[head];
+        auto type = opcode_of(ins);
+        auto addrm = AddressMode(decode_addrm(ins));
+        auto dst = Register(decode_dst(ins));
+        auto index = Register(decode_src(ins));
+        if (!is_index_register(index) || dst == index || dst == Register::SP) continue;
+
+        if (type == T::STORE && addrm == AddressMode::REGISTER) { // STORE's REGISTER is a direct store
+            if (is_increment_of(code[head + 1], values[head + 1], index)
+                && is_loop_bound_check(code[head + 2], index, index)
+                && is_loop_back_jump(code[head + 3], values[head + 3], head)) {
+                code[head] = with_opcode(ins, T::EXT_FILL);
+                recognized += 1;
+            }
+        } else if (type == T::ADD && addrm == AddressMode::DIRECT) {
+            if (is_increment_of(code[head + 1], values[head + 1], index)
+                && is_loop_bound_check(code[head + 2], index, dst)
+                && is_loop_back_jump(code[head + 3], values[head + 3], head)) {
+                code[head] = with_opcode(ins, T::EXT_SUM);
+                recognized += 1;
+            }
+        } else if (type == T::LOAD && addrm == AddressMode::DIRECT && head + 4 < size) {
+            u32 store = code[head + 1];
+            if (opcode_of(store) == T::STORE
+                && AddressMode(decode_addrm(store)) == AddressMode::REGISTER
+                && Register(decode_dst(store)) == dst
+                && Register(decode_src(store)) == index
+                && is_increment_of(code[head + 2], values[head + 2], index)
+                && is_loop_bound_check(code[head + 3], index, dst)
+                && is_loop_back_jump(code[head + 4], values[head + 4], head)) {
+                code[head] = with_opcode(ins, T::EXT_COPY);
+                recognized += 1;
+            }
+        }
+    }
+    return recognized;
+}
+
+//
+// Range analysis
+//
+
+struct Interval {
+    i64 lo, hi;
+
+    bool operator==(const Interval &) const = default;
+};
+
+constexpr Interval ANY_VALUE = { INT32_MIN, INT32_MAX };
+
+static Interval hull(Interval a, Interval b) { return { std::min(a.lo, b.lo), std::max(a.hi, b.hi) }; }
+
+// The registers wrap around on overflow, so anything that doesn't fit could be anything
+static Interval fit(Interval a) {
+    if (a.lo > a.hi || a.lo < INT32_MIN || a.hi > INT32_MAX) return ANY_VALUE;
+    return a;
+}
+
+// What is known about the registers before an instruction executes
+struct RangeState {
+    std::array<Interval, 8> regs; // R0-R7. SP is tracked globally, see RangeAnalysis.
+    i32 comp_reg; // register compared by the last COMP, or -1 if unknown
+    Interval comp_value; // what it was compared against
+    bool reachable;
+
+    bool operator==(const RangeState &) const = default;
+};
+
+static RangeState join(const RangeState &a, const RangeState &b) {
+    if (!a.reachable) return b;
+    if (!b.reachable) return a;
+
+    RangeState out = a;
+    for (std::size_t r = 0; r < out.regs.size(); ++r) out.regs[r] = hull(a.regs[r], b.regs[r]);
+    if (a.comp_reg != b.comp_reg || a.comp_value != b.comp_value) out.comp_reg = -1;
+    return out;
+}
+
+// Pushes bounds that keep growing to the next threshold so that loops reach a fixpoint
+// quickly. Thresholds come from the constants the program compares against, since
+// those tend to be the loop bounds; going straight to the limits of i32 would
+// make the next increment overflow and lose the other bound too.
+static RangeState widen(const RangeState &old, const RangeState &next, const std::vector<i64> &thresholds) {
+    if (!old.reachable) return next;
+
+    RangeState out = next;
+    for (std::size_t r = 0; r < out.regs.size(); ++r) {
+        if (next.regs[r].lo < old.regs[r].lo) {
+            auto it = std::upper_bound(thresholds.begin(), thresholds.end(), next.regs[r].lo);
+            out.regs[r].lo = *(it - 1);
+        }
+        if (next.regs[r].hi > old.regs[r].hi) {
+            out.regs[r].hi = *std::lower_bound(thresholds.begin(), thresholds.end(), next.regs[r].hi);
+        }
+    }
+    return out;
+}
+
+struct RangeAnalysis {
+    const std::vector<u32> &code;
+    const std::vector<i32> &values; // full values of `code`
+    Interval sp;          // SP between instructions, valid everywhere
+    Interval callee_fp;   // FP on entry to a subroutine
+    Interval valid_addresses;
+
+    Interval get(const RangeState &state, Register reg) const {
+        if (reg == Register::EXT_ZR) return { 0, 0 };
+        if (reg == Register::SP) return sp;
+        if (u32(reg) < state.regs.size()) return state.regs[u32(reg)];
+        return ANY_VALUE; // virtual registers hold memory contents
+    }
+
+    static void set(RangeState &state, Register reg, Interval value) {
+        if (reg == Register::SP || u32(reg) >= state.regs.size()) return;
+        state.regs[u32(reg)] = fit(value);
+        if (state.comp_reg == i32(reg)) state.comp_reg = -1;
+    }
+
+    // The value the instruction at `idx` computes before executing, or the address a STORE writes to
+    Interval operand(const RangeState &state, u32 idx) const {
+        i64 value = values[idx];
+        switch (AddressMode(decode_addrm(code[idx]))) {
+            case AddressMode::IMMEDIATE: return { value, value };
+            case AddressMode::REGISTER: return fit(first_address(state, idx));
+            default: return ANY_VALUE; // Loaded from memory
+        }
+    }
+
+    // Range of the first address the instruction at `idx` accesses memory at
+    Interval first_address(const RangeState &state, u32 idx) const {
+        auto reg = get(state, Register(decode_src(code[idx])));
+        i64 value = values[idx];
+        return { reg.lo + value, reg.hi + value };
+    }
+
+    bool in_bounds(Interval address) const {
+        return address.lo >= valid_addresses.lo && address.hi <= valid_addresses.hi;
+    }
+
+    static Interval arithmetic(InstructionType type, Interval a, Interval b) {
+        switch (type) {
+            case InstructionType::ADD: return fit({ a.lo + b.lo, a.hi + b.hi });
+            case InstructionType::SUB: return fit({ a.lo - b.hi, a.hi - b.lo });
+            case InstructionType::MUL: {
+                if (a.lo < INT32_MIN / 2 || a.hi > INT32_MAX / 2) return ANY_VALUE; // keep products in i64
+                if (b.lo < INT32_MIN / 2 || b.hi > INT32_MAX / 2) return ANY_VALUE;
+                i64 p[] = { a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi };
+                return fit({ *std::min_element(p, p + 4), *std::max_element(p, p + 4) });
+            }
+            case InstructionType::MOD:
+                // Result has the sign of the dividend and is smaller than the divisor
+                if (b.lo > 0) return { a.lo >= 0 ? 0 : -(b.hi - 1), a.hi <= 0 ? 0 : b.hi - 1 };
+                return ANY_VALUE;
+            case InstructionType::AND:
+                if (b.lo >= 0) return { 0, b.hi };
+                if (a.lo >= 0) return { 0, a.hi };
+                return ANY_VALUE;
+            default:
+                return ANY_VALUE;
+        }
+    }
+
+    // Narrows `reg` on one edge of a conditional jump. `taken` tells which edge.
+    void refine(RangeState &state, InstructionType type, bool taken, Register j1_reg) const {
+        using T = InstructionType;
+
+        Interval *reg{};
+        Interval other{};
+        if (type >= T::JLES && type <= T::JNGRE) {
+            if (state.comp_reg < 0) return;
+            reg = &state.regs[state.comp_reg];
+            other = state.comp_value;
+        } else {
+            if (j1_reg == Register::SP || u32(j1_reg) >= state.regs.size()) return;
+            reg = &state.regs[u32(j1_reg)];
+            other = { 0, 0 };
+        }
+
+        // Normalize to the condition that holds on this edge
+        static constexpr std::pair<T, T> NEGATIONS[] = {
+            { T::JLES, T::JNLES }, { T::JEQU, T::JNEQU }, { T::JGRE, T::JNGRE },
+            { T::JNEG, T::JNNEG }, { T::JZER, T::JNZER }, { T::JPOS, T::JNPOS },
+        };
+        if (!taken) {
+            for (auto [a, b] : NEGATIONS) {
+                if (type == a) { type = b; break; }
+                if (type == b) { type = a; break; }
+            }
+        }
+
+        Interval r = *reg;
+        switch (type) {
+            case T::JLES: case T::JNEG:   r.hi = std::min(r.hi, other.hi - 1); break;
+            case T::JNGRE: case T::JNPOS: r.hi = std::min(r.hi, other.hi); break;
+            case T::JGRE: case T::JPOS:   r.lo = std::max(r.lo, other.lo + 1); break;
+            case T::JNLES: case T::JNNEG: r.lo = std::max(r.lo, other.lo); break;
+            case T::JEQU: case T::JZER:   r = { std::max(r.lo, other.lo), std::min(r.hi, other.hi) }; break;
+            default: break;
+        }
+
+        // An empty range means the edge is never taken, but keeping it simple is fine
+        if (r.lo <= r.hi) *reg = r;
+    }
+
+    // Computes the states after `idx` and hands them to `out(successor, state)`
+    template<typename Fn>
+    void step(u32 idx, const RangeState &in, Fn &&out) const {
+        using T = InstructionType;
+
+        u32 ins = code[idx];
+        auto type = opcode_of(ins);
+        auto dst = Register(decode_dst(ins));
+        auto src = Register(decode_src(ins));
+        u32 target = u32(values[idx]);
+
+        RangeState next = in;
+        switch (type) {
+            case T::LOAD:
+                set(next, dst, operand(in, idx));
+                break;
+            case T::ADD: case T::SUB: case T::MUL: case T::DIV: case T::MOD:
+            case T::AND: case T::OR: case T::XOR: case T::SHL: case T::SHR: case T::SHRA:
+                set(next, dst, arithmetic(type, get(in, dst), operand(in, idx)));
+                break;
+            case T::NOT: case T::IN:
+                set(next, dst, ANY_VALUE);
+                break;
+            case T::POP:
+                set(next, src, ANY_VALUE);
+                break;
+            case T::POPR:
+                for (u32 r = 0; r <= u32(Register::R5); ++r) set(next, Register(r), ANY_VALUE);
+                break;
+            case T::COMP:
+                next.comp_reg = (dst == Register::SP) ? -1 : i32(dst);
+                next.comp_value = operand(in, idx);
+                break;
+            case T::STORE:
+                // Address 0 is R0
+                if (operand(in, idx).lo <= 0 && operand(in, idx).hi >= 0) set(next, Register::R0, ANY_VALUE);
+                break;
+            case T::CALL: case T::EXT_TAILCALL: {
+                RangeState callee = next;
+                callee.regs[u32(Register::FP)] = callee_fp;
+                callee.comp_reg = -1;
+                if (target < code.size()) out(target, callee);
+
+                // Whatever the callee did to the registers, and FP is restored from the stack
+                RangeState after = next;
+                for (auto &reg : after.regs) reg = ANY_VALUE;
+                after.comp_reg = -1;
+                out(idx + 1, after);
+                return;
+            }
+            case T::EXIT: case T::EXT_HALT:
+                return;
+            case T::JUMP:
+                if (target < code.size()) out(target, next);
+                return;
+            default:
+                break;
+        }
+
+        if (type >= T::JNEG && type <= T::JNGRE) {
+            RangeState taken = next;
+            refine(taken, type, true, dst);
+            if (target < code.size()) out(target, taken);
+            refine(next, type, false, dst);
+        }
+
+        if (idx + 1 < code.size()) out(idx + 1, next);
+    }
+};
+
+// EXIT returns to whatever address is on the stack, so a program that pushes one of its
+// own (or overwrites the one CALL saved) can land anywhere with registers the analysis
+// knows nothing about. This checks that every EXIT returns right after the CALL that
+// set up its frame: the main program never reaches an EXIT, and subroutines leave SP and
+// FP to the stack instructions, never pop below their frame, are back at its base when
+// they exit, and only store below the stack or to stack slots that the caller or they
+// themselves pushed. The stores are checked against `states`, which hold up to the first
+// return that went astray, so there can't be one.
+static bool returns_are_trusted(const RangeAnalysis &analysis, const std::vector<RangeState> &states,
+                                i64 stack_start) {
+    using T = InstructionType;
+    const auto &code = analysis.code;
+    const auto &values = analysis.values;
+    const u32 size = u32(code.size());
+
+    for (u32 ins : code) {
+        auto type = opcode_of(ins);
+        if (writes_dst_register(type) && is_stack_register(Register(decode_dst(ins)))) return false;
+        if (type == T::POP && is_stack_register(Register(decode_src(ins)))) return false;
+    }
+
+    constexpr i32 UNVISITED = INT32_MIN;
+    auto depths = std::vector<i32>(size, UNVISITED);
+    auto worklist = std::vector<u32>{};
+    auto visited = std::vector<u32>{};
+
+    // Calls `fn(idx)` for everything reachable from `start` (without entering calls) until it returns false
+    auto walk = [&](u32 start, auto &&fn) {
+        for (u32 idx : visited) depths[idx] = UNVISITED;
+        visited = { start };
+        worklist = { start };
+        depths[start] = 0;
+        while (!worklist.empty()) {
+            u32 idx = worklist.back();
+            worklist.pop_back();
+            if (!fn(idx)) return false;
+        }
+        return true;
+    };
+    auto visit = [&](u32 idx, i32 depth) {
+        if (depths[idx] == UNVISITED) {
+            depths[idx] = depth;
+            visited.push_back(idx);
+            worklist.push_back(idx);
+        }
+        return depths[idx] == depth;
+    };
+
+    bool main_exits = !walk(0, [&](u32 idx) {
+        if (opcode_of(code[idx]) == T::EXIT) return false;
+        local_successors(code, values, idx, [&](u32 succ) { visit(succ, 0); });
+        return true;
+    });
+    if (main_exits) return false;
+
+    // Parameters each subroutine cleans up, or -1 if it never returns
+    auto num_params = tsl::robin_map<u32, i32>{};
+    for (u32 idx = 0; idx < size; ++idx) {
+        if (is_call(opcode_of(code[idx])) && u32(values[idx]) < size) num_params.emplace(u32(values[idx]), -1);
+    }
+    for (auto it = num_params.begin(); it != num_params.end(); ++it) {
+        i32 params = -1;
+        bool agree = walk(it->first, [&](u32 idx) {
+            if (opcode_of(code[idx]) == T::EXIT) {
+                if (params >= 0 && params != values[idx]) return false;
+                params = values[idx];
+            }
+            local_successors(code, values, idx, [&](u32 succ) { visit(succ, 0); });
+            return true;
+        });
+        if (!agree) return false;
+        it.value() = params;
+    }
+
+    // Stack depth relative to FP, where CALL saved the caller's FP and the return address
+    // below it. Slots below those belong to the caller, which has to have pushed them.
+    struct Call {
+        u32 callee;
+        i32 depth;
+        bool tail;           // the frame is gone by the time the callee runs
+        bool passes_result;  // and the callee writes to our return slot
+    };
+    auto calls = std::vector<Call>{};
+    auto lowest_slot = tsl::robin_map<u32, i64>{};
+    for (auto [entry, params] : num_params) {
+        i64 lowest = 0;
+        bool trusted = walk(entry, [&](u32 idx) {
+            u32 ins = code[idx];
+            auto type = opcode_of(ins);
+            i32 depth = depths[idx];
+            switch (type) {
+                case T::PUSH: depth += 1; break;
+                case T::POP: depth -= 1; break;
+                case T::PUSHR: depth += 6; break;
+                case T::POPR: depth -= 6; break;
+                case T::EXIT: return depth == 0;
+                case T::CALL: case T::EXT_TAILCALL: {
+                    u32 callee = u32(values[idx]);
+                    calls.push_back(Call{ callee, depth, type == T::EXT_TAILCALL, type == T::EXT_TAILCALL && decode_src(ins) != 0 });
+                    auto it = num_params.find(callee);
+                    if (it == num_params.end() || it->second < 0) return true; // doesn't come back
+                    depth -= it->second;
+                    break;
+                }
+                case T::STORE: {
+                    if (!states[idx].reachable) break;
+                    auto src = Register(decode_src(ins));
+                    if (AddressMode(decode_addrm(ins)) == AddressMode::REGISTER && is_stack_register(src)) {
+                        i64 slot = values[idx] + (src == Register::SP ? depth : 0);
+                        if (slot == 0 || slot == -1) return false;
+                        lowest = std::min(lowest, slot);
+                        break;
+                    }
+                    if (analysis.operand(states[idx], idx).hi >= stack_start) return false;
+                    break;
+                }
+                default:
+                    break;
+            }
+            if (depth < 0) return false;
+
+            bool consistent = true;
+            local_successors(code, values, idx, [&](u32 succ) { consistent &= visit(succ, depth); });
+            return consistent;
+        });
+        if (!trusted) return false;
+        lowest_slot.emplace(entry, lowest);
+    }
+
+    for (auto [callee, depth, tail, passes_result] : calls) {
+        auto it = lowest_slot.find(callee);
+        if (it == lowest_slot.end()) continue;
+        // After a tail call, only the callee's own arguments (and return slot) are left below its frame
+        i64 lowest_allowed = tail ? -1 - i64(num_params[callee]) - passes_result : -1 - i64(depth);
+        if (it->second < lowest_allowed) return false;
+    }
+    return true;
+}
+
+// Moves single-word variables into virtual registers when it can be shown that
+// nothing but their own symbol (with no base register) can ever reach them.
+//
+// Memory accesses through R0-R5 or through a pointer loaded from memory could land
+// anywhere, so their presence disables the pass entirely. Accesses relative to SP/FP
+// are fine as long as the program leaves those registers to the stack instructions:
+// the stack then starts past the data section, and only offsets far enough below
+// the stack can reach variables. That needs FP to always point into the stack too,
+// so the pass is also off unless every EXIT can be shown to return to its CALL.
+static u32 promote_variables(Program &program) {
+    auto uses = tsl::robin_map<i32, u32>{};
+    for (i32 address : program.scalar_addresses) uses[address] = 0;
+    if (uses.empty()) return 0;
+
+    const auto &values = program.wide_operands;
+    i32 lowest_stack_offset = 0;
+    for (u32 idx = 0; idx < program.instructions.size(); ++idx) {
+        u32 ins = program.instructions[idx];
+        auto type = opcode_of(ins);
+        auto dst = Register(decode_dst(ins));
+        auto src = Register(decode_src(ins));
+
+        if (writes_dst_register(type) && is_stack_register(dst)) return 0;
+        if (type == InstructionType::POP && is_stack_register(src)) return 0;
+
+        if (!accesses_memory(ins)) continue;
+        if (accesses_memory_indirectly(ins)) return 0;
+
+        if (src == Register::EXT_ZR) {
+            if (auto it = uses.find(values[idx]); it != uses.end()) it.value() += 1;
+        } else if (is_stack_register(src)) {
+            lowest_stack_offset = std::min(lowest_stack_offset, values[idx]);
+        } else {
+            return 0;
+        }
+    }
+
+    // Nothing is known about the registers, which is enough as the only stores
+    // that are left are to fixed addresses or relative to SP/FP
+    i64 stack_start = i64(program.data_section_bytes) + STACK_GUARD_WORDS;
+    auto analysis = RangeAnalysis{
+        .code = program.instructions,
+        .values = values,
+        .sp = ANY_VALUE,
+        .callee_fp = ANY_VALUE,
+        .valid_addresses = ANY_VALUE,
+    };
+    auto anything = RangeState{ .regs = {}, .comp_reg = -1, .comp_value = {}, .reachable = true };
+    for (auto &reg : anything.regs) reg = ANY_VALUE;
+    if (!returns_are_trusted(analysis, std::vector<RangeState>(program.instructions.size(), anything), stack_start)) {
+        return 0;
+    }
+
+    // SP can drop one below the start of the stack (see Lop_pop), FP cannot.
+    i64 lowest_stack_address = i64(program.data_section_bytes) + STACK_GUARD_WORDS - 1 + lowest_stack_offset;
+
+    auto candidates = std::vector<std::pair<i32, u32>>{};
+    for (auto [address, count] : uses) {
+        if (count > 0 && address < lowest_stack_address) candidates.emplace_back(address, count);
+    }
+
+    // Most referenced first; ties broken by address to keep the output deterministic
+    std::sort(candidates.begin(), candidates.end(), [](const auto &a, const auto &b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+    if (candidates.size() > NUM_VIRTUAL_REGISTERS) candidates.resize(NUM_VIRTUAL_REGISTERS);
+
+    auto reg_of = tsl::robin_map<i32, Register>{};
+    for (const auto &[address, count] : candidates) {
+        auto reg = Register(FIRST_VIRTUAL_REGISTER + program.promoted_variables.size());
+        reg_of[address] = reg;
+        program.promoted_variables.push_back(PromotedVariable{ .address = address, .reg = reg });
+    }
+
+    for (u32 idx = 0; idx < program.instructions.size(); ++idx) {
+        u32 &ins = program.instructions[idx];
+        if (!accesses_memory(ins) || Register(decode_src(ins)) != Register::EXT_ZR) continue;
+
+        auto it = reg_of.find(program.wide_operands[idx]);
+        if (it == reg_of.end()) continue;
+
+        auto type = opcode_of(ins);
+        auto dst = Register(decode_dst(ins));
+        if (type == InstructionType::STORE) {
+            // `mem[value] = dst`, and registers live at negative addresses
+            program.wide_operands[idx] = -i32(it->second);
+            ins = make_instruction(type, dst, Register::EXT_ZR, AddressMode::IMMEDIATE, -i32(it->second))
+                | encode_bounds_proven(true);
+        } else {
+            program.wide_operands[idx] = 0;
+            ins = make_instruction(type, dst, it->second, AddressMode::REGISTER, 0);
+        }
+    }
+
+    return u32(candidates.size());
+}
+
+// Proves memory accesses to be within bounds with a range analysis over the registers,
+// and marks them so that execute() can skip the checks.
+//
+// Subroutines are assumed to return where they were called from, and if that can't be
+// shown, every instruction could be reached with anything in the registers.
+//
+// The analysis relies on the bounds that the stack instructions check for, so SP is
+// assumed to be somewhere in the stack unless the program writes to it explicitly,
+// and the same goes for FP from the start of a subroutine until it calls another one.
+// The proofs are only valid for the stack size the program is optimized for.
+static u32 prove_memory_accesses(Program &program, u64 stack_size) {
+    const auto &code = program.instructions;
+    const u32 size = u32(code.size());
+    if (size == 0) return 0;
+
+    // Must match the layout set up by create_runtime() and execute()
+    i64 memory_size = i64(program.data_section_bytes) + i64(stack_size);
+    i64 stack_start = i64(program.data_section_bytes) + STACK_GUARD_WORDS;
+    i64 stack_end = stack_start + i64(stack_size) - 2 * STACK_GUARD_WORDS;
+
+    // Always contains the limits of i32, so widen() never runs out of them
+    auto thresholds = std::vector<i64>{ INT32_MIN, -1, 0, 1, INT32_MAX };
+    bool explicit_sp_writes = false;
+    for (u32 idx = 0; idx < size; ++idx) {
+        u32 ins = code[idx];
+        auto type = opcode_of(ins);
+        if (type == InstructionType::COMP && AddressMode(decode_addrm(ins)) == AddressMode::IMMEDIATE) {
+            for (i64 delta : { -1, 0, 1 }) thresholds.push_back(i64(program.wide_operands[idx]) + delta);
+        }
+        if (writes_dst_register(type) && Register(decode_dst(ins)) == Register::SP) explicit_sp_writes = true;
+        if (type == InstructionType::POP && Register(decode_src(ins)) == Register::SP) explicit_sp_writes = true;
+    }
+
+    std::sort(thresholds.begin(), thresholds.end());
+    thresholds.erase(std::unique(thresholds.begin(), thresholds.end()), thresholds.end());
+
+    auto analysis = RangeAnalysis{
+        .code = code,
+        .values = program.wide_operands,
+        .sp = { stack_start - 1, stack_end + 1 },
+        .callee_fp = { stack_start + 1, stack_end + 1 },
+        .valid_addresses = { 0, memory_size - 1 },
+    };
+    if (explicit_sp_writes || stack_size < 4 * STACK_GUARD_WORDS) {
+        analysis.sp = ANY_VALUE;
+        analysis.callee_fp = ANY_VALUE;
+    }
+
+    // Registers are reset with the memory between benchmark iterations, but the proofs
+    // don't rely on what they start out as: nothing is known about them at the start
+    auto unreachable = RangeState{ .regs = {}, .comp_reg = -1, .comp_value = {}, .reachable = false };
+    auto states = std::vector<RangeState>(size, unreachable);
+    states[0] = RangeState{ .regs = {}, .comp_reg = -1, .comp_value = {}, .reachable = true };
+    for (auto &reg : states[0].regs) reg = ANY_VALUE;
+
+    // Big programs can have thousands of thresholds, and stepping through them one by one
+    // takes forever. Bounds still growing after a while go straight to the limits.
+    constexpr u32 WIDEN_AFTER = 4;
+    constexpr u32 GIVE_UP_AFTER = WIDEN_AFTER + 16;
+    const auto limits = std::vector<i64>{ INT32_MIN, INT32_MAX };
+    auto visits = std::vector<u32>(size, 0);
+    auto worklist = std::vector<u32>{ 0 };
+    auto queued = std::vector<bool>(size, false);
+    queued[0] = true;
+
+    while (!worklist.empty()) {
+        u32 idx = worklist.back();
+        worklist.pop_back();
+        queued[idx] = false;
+
+        analysis.step(idx, states[idx], [&](u32 succ, const RangeState &state) {
+            RangeState merged = join(states[succ], state);
+            if (++visits[succ] > WIDEN_AFTER) {
+                merged = widen(states[succ], merged, visits[succ] > GIVE_UP_AFTER ? limits : thresholds);
+            }
+            if (merged == states[succ]) return;
+
+            states[succ] = merged;
+            if (!queued[succ]) {
+                queued[succ] = true;
+                worklist.push_back(succ);
+            }
+        });
+    }
+
+    // Widening loses loop bounds such as `COMP R1, =N; JLES Loop`. Recomputing the
+    // states from the (sound) widened ones a couple of times gets them back.
+    for (u32 round = 0; round < 3; ++round) {
+        auto narrowed = std::vector<RangeState>(size, unreachable);
+        narrowed[0] = states[0];
+        for (u32 idx = 0; idx < size; ++idx) {
+            if (!states[idx].reachable) continue;
+            analysis.step(idx, states[idx], [&](u32 succ, const RangeState &state) {
+                narrowed[succ] = join(narrowed[succ], state);
+            });
+        }
+        states = std::move(narrowed);
+    }
+
+    if (!returns_are_trusted(analysis, states, stack_start)) {
+        auto anything = RangeState{ .regs = {}, .comp_reg = -1, .comp_value = {}, .reachable = true };
+        for (auto &reg : anything.regs) reg = ANY_VALUE;
+        std::fill(states.begin(), states.end(), anything);
+    }
+
+    u32 proven = 0;
+    for (u32 idx = 0; idx < size; ++idx) {
+        u32 &ins = program.instructions[idx];
+        if (!states[idx].reachable || decode_bounds_proven(ins)) continue;
+        if (!accesses_memory(ins)) continue;
+
+        // For indirect stores the address that matters can't be known
+        if (opcode_of(ins) == InstructionType::STORE && accesses_memory_indirectly(ins)) continue;
+
+        if (analysis.in_bounds(analysis.first_address(states[idx], idx))) {
+            ins |= encode_bounds_proven(true);
+            proven += 1;
+        }
+    }
+    return proven;
+}
+
+//
+// Memoization
+//
+
+// What a register or stack slot of a subroutine holds, as far as purity is concerned:
+// 0-5 is the value the caller had in that register (saved to be restored later, but not
+// to be looked at), COMPUTED is something derived from the parameters alone, and MIXED
+// is anything else.
+using ValueOrigin = i8;
+constexpr ValueOrigin COMPUTED = 6;
+constexpr ValueOrigin MIXED = 7;
+
+constexpr ValueOrigin CALLER_COMP = 0; // for `comp`: the caller's COMP state, untouched
+
+struct PurityState {
+    std::array<ValueOrigin, 6> regs; // R0-R5
+    std::vector<ValueOrigin> stack;  // words pushed since entry, bottom first
+    ValueOrigin comp;                // the state JLES and friends look at
+    bool result_written;
+    bool reachable;
+
+    bool operator==(const PurityState &) const = default;
+};
+
+// Follows the subroutine at `entry` without entering the subroutines it calls.
+// Returns the number of parameters all of its EXITs agree on, or -1.
+static i32 subroutine_params(const std::vector<u32> &code, const std::vector<i32> &values, u32 entry, std::vector<u32> &body) {
+    using T = InstructionType;
+
+    auto seen = std::vector<bool>(code.size(), false);
+    auto pending = std::vector<u32>{ entry };
+    i32 params = -1;
+    body.clear();
+
+    while (!pending.empty()) {
+        u32 idx = pending.back();
+        pending.pop_back();
+        if (idx >= code.size() || seen[idx]) continue;
+        seen[idx] = true;
+        body.push_back(idx);
+
+        u32 ins = code[idx];
+        auto type = opcode_of(ins);
+        if (type == T::EXIT) {
+            if (params >= 0 && params != values[idx]) return -1;
+            params = values[idx];
+            continue;
+        }
+        if (type == T::EXT_HALT) continue;
+
+        if (is_jump(type) && !is_call(type)) pending.push_back(u32(values[idx]));
+        if (type != T::JUMP) pending.push_back(idx + 1);
+    }
+
+    if (params < 0 || params > i32(MEMO_MAX_ARGS)) return -1;
+    return params;
+}
+
+struct MemoCandidate {
+    u32 num_params;
+    bool sets_comp; // or leaves the caller's COMP state as is
+    std::vector<u32> body;
+};
+
+// Whether the subroutine at `entry` computes its return value from its parameters alone,
+// leaving everything but its return slot, the COMP state (see `sets_comp`) and the stack
+// above SP as it found it. Calls to the subroutines in `pure` are assumed to do the same.
+static bool is_pure(const std::vector<u32> &code, const std::vector<i32> &values, u32 entry,
+                    const tsl::robin_map<u32, MemoCandidate> &pure, bool &sets_comp) {
+    using T = InstructionType;
+
+    const i32 result_offset = -2 - i32(pure.at(entry).num_params);
+    ValueOrigin exit_comp = MIXED; // until the first EXIT
+
+    auto join = [](PurityState &into, const PurityState &from) {
+        if (!into.reachable) {
+            into = from;
+            return true;
+        }
+        if (into.stack.size() != from.stack.size()) return false;
+
+        for (u32 r = 0; r < into.regs.size(); ++r) {
+            if (into.regs[r] != from.regs[r]) into.regs[r] = MIXED;
+        }
+        for (u32 i = 0; i < into.stack.size(); ++i) {
+            if (into.stack[i] != from.stack[i]) into.stack[i] = MIXED;
+        }
+        if (into.comp != from.comp) into.comp = MIXED;
+        into.result_written &= from.result_written;
+        return true;
+    };
+
+    auto states = std::vector<PurityState>(code.size());
+    states[entry] = PurityState{ .regs = { 0, 1, 2, 3, 4, 5 }, .stack = {}, .comp = CALLER_COMP,
+        .result_written = false, .reachable = true };
+    auto worklist = std::vector<u32>{ entry };
+
+    while (!worklist.empty()) {
+        u32 idx = worklist.back();
+        worklist.pop_back();
+
+        PurityState s = states[idx];
+        u32 ins = code[idx];
+        auto type = opcode_of(ins);
+        auto addrm = AddressMode(decode_addrm(ins));
+        auto dst = Register(decode_dst(ins));
+        auto src = Register(decode_src(ins));
+        i32 value = values[idx];
+
+        auto reg = [&](Register r) -> ValueOrigin {
+            if (r == Register::EXT_ZR) return COMPUTED;
+            if (u32(r) <= u32(Register::R5)) return s.regs[u32(r)];
+            return MIXED; // SP and FP depend on where the stack is, virtual registers are globals
+        };
+        auto frame_slot = [&](i32 offset) -> ValueOrigin {
+            if (offset >= result_offset + 1 && offset <= -2) return COMPUTED; // parameter
+            if (offset >= 1 && offset <= i32(s.stack.size())) return s.stack[offset - 1];
+            return MIXED;
+        };
+        auto operand = [&]() -> ValueOrigin {
+            switch (addrm) {
+                case AddressMode::IMMEDIATE: return COMPUTED;
+                case AddressMode::REGISTER: return value == 0 ? reg(src) : (reg(src) == COMPUTED ? COMPUTED : MIXED);
+                case AddressMode::DIRECT: return src == Register::FP ? frame_slot(value) : MIXED;
+                default: return MIXED;
+            }
+        };
+        auto general = [](Register r) { return u32(r) <= u32(Register::R5); };
+
+        bool falls_through = true;
+        switch (type) {
+            case T::LOAD:
+                if (!general(dst)) return false;
+                s.regs[u32(dst)] = operand();
+                break;
+            case T::ADD: case T::SUB: case T::MUL: case T::DIV: case T::MOD:
+            case T::AND: case T::OR: case T::XOR: case T::SHL: case T::SHR: case T::SHRA:
+                if (!general(dst) || reg(dst) != COMPUTED || operand() != COMPUTED) return false;
+                break;
+            case T::NOT:
+                if (!general(dst) || reg(dst) != COMPUTED) return false;
+                break;
+            case T::COMP:
+                if (reg(dst) != COMPUTED || operand() != COMPUTED) return false;
+                s.comp = COMPUTED;
+                break;
+            case T::STORE: {
+                // Only the return slot and the subroutine's own stack space
+                if (addrm != AddressMode::REGISTER || src != Register::FP) return false;
+                if (value == result_offset) {
+                    if (reg(dst) != COMPUTED) return false;
+                    s.result_written = true;
+                } else if (value >= 1 && value <= i32(s.stack.size())) {
+                    s.stack[value - 1] = reg(dst);
+                } else {
+                    return false;
+                }
+                break;
+            }
+            case T::PUSH:
+                if (dst != Register::SP) return false;
+                s.stack.push_back(operand());
+                break;
+            case T::POP:
+                if (dst != Register::SP || !general(src) || s.stack.empty()) return false;
+                s.regs[u32(src)] = s.stack.back();
+                s.stack.pop_back();
+                break;
+            case T::PUSHR:
+                if (dst != Register::SP) return false;
+                s.stack.insert(s.stack.end(), s.regs.begin(), s.regs.end());
+                break;
+            case T::POPR:
+                if (dst != Register::SP || s.stack.size() < s.regs.size()) return false;
+                for (u32 r = u32(s.regs.size()); r-- > 0;) {
+                    s.regs[r] = s.stack.back();
+                    s.stack.pop_back();
+                }
+                break;
+            case T::CALL: {
+                auto it = pure.find(u32(value));
+                if (it == pure.end() || s.stack.size() < it->second.num_params + 1) return false;
+                for (u32 i = 0; i < it->second.num_params; ++i) {
+                    if (s.stack.back() != COMPUTED) return false;
+                    s.stack.pop_back();
+                }
+                s.stack.back() = COMPUTED; // its return value
+                if (it->second.sets_comp) s.comp = COMPUTED;
+                break;
+            }
+            case T::EXIT: {
+                if (!s.stack.empty() || !s.result_written) return false;
+                for (u32 r = 0; r < s.regs.size(); ++r) {
+                    if (s.regs[r] != ValueOrigin(r)) return false;
+                }
+
+                // The cache can either restore the COMP state or leave it alone, not both
+                if (s.comp == MIXED || (exit_comp != MIXED && exit_comp != s.comp)) return false;
+                exit_comp = s.comp;
+                falls_through = false;
+                break;
+            }
+            case T::JUMP:
+                falls_through = false;
+                [[fallthrough]];
+            case T::JNEG: case T::JZER: case T::JPOS: case T::JNNEG: case T::JNZER: case T::JNPOS:
+            case T::JLES: case T::JEQU: case T::JGRE: case T::JNLES: case T::JNEQU: case T::JNGRE: {
+                if (addrm != AddressMode::IMMEDIATE || u32(value) >= code.size()) return false;
+                if (type >= T::JNEG && type <= T::JNPOS && reg(dst) != COMPUTED) return false;
+                if (type >= T::JLES && type <= T::JNGRE && s.comp != COMPUTED) return false;
+
+                auto before = states[u32(value)];
+                if (!join(states[u32(value)], s)) return false;
+                if (states[u32(value)] != before) worklist.push_back(u32(value));
+                break;
+            }
+            default:
+                return false; // I/O, halting and anything else with side effects
+        }
+
+        if (!falls_through) continue;
+        if (idx + 1 >= code.size()) return false;
+
+        auto before = states[idx + 1];
+        if (!join(states[idx + 1], s)) return false;
+        if (states[idx + 1] != before) worklist.push_back(idx + 1);
+    }
+
+    sets_comp = exit_comp == COMPUTED;
+    return true;
+}
+
+// Turns calls to pure subroutines (see is_pure()) into EXT_MCALL, which looks up the
+// result from a cache keyed on the arguments before calling, and their EXITs into
+// EXT_MEXIT, which fills the cache. CALL has no use for the dst and src fields, so
+// EXT_MCALL has the number of parameters in dst, and src is 1 if the subroutine sets
+// the COMP state (which a cache hit then has to restore).
+static u32 memoize_subroutines(Program &program) {
+    using T = InstructionType;
+    auto &code = program.instructions;
+    const auto &values = program.wide_operands;
+
+    // Every call of a memoized subroutine must go through the cache
+    auto candidates = tsl::robin_map<u32, MemoCandidate>{};
+    auto excluded = tsl::robin_set<u32>{};
+    for (u32 idx = 0; idx < code.size(); ++idx) {
+        u32 ins = code[idx];
+        auto type = opcode_of(ins);
+        if (!is_call(type)) continue;
+        if (AddressMode(decode_addrm(ins)) != AddressMode::IMMEDIATE) return 0; // could go anywhere
+
+        u32 target = u32(values[idx]);
+        if (type == T::CALL && target < code.size()) candidates[target] = MemoCandidate{};
+        else excluded.insert(target);
+    }
+
+    for (u32 target : excluded) candidates.erase(target);
+    for (auto it = candidates.begin(); it != candidates.end();) {
+        i32 params = subroutine_params(code, values, it->first, it.value().body);
+        if (params < 0) {
+            it = candidates.erase(it);
+        } else {
+            it.value().num_params = u32(params);
+            ++it;
+        }
+    }
+
+    // Assuming a subroutine pure can only make others look pure through calling it,
+    // so drop the impure ones until the rest agree. Same goes for whether they set
+    // the COMP state, which starts out assumed not to.
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (auto it = candidates.begin(); it != candidates.end();) {
+            bool sets_comp{};
+            if (!is_pure(code, values, it->first, candidates, sets_comp)) {
+                it = candidates.erase(it);
+                changed = true;
+                continue;
+            }
+            if (sets_comp != it->second.sets_comp) {
+                it.value().sets_comp = sets_comp;
+                changed = true;
+            }
+            ++it;
+        }
+    }
+
+    for (u32 idx = 0; idx < code.size(); ++idx) {
+        if (opcode_of(code[idx]) != T::CALL) continue;
+        if (auto it = candidates.find(u32(values[idx])); it != candidates.end()) {
+            auto num_params = Register(it->second.num_params);
+            auto sets_comp = Register(it->second.sets_comp ? 1 : 0);
+            code[idx] = make_instruction(T::EXT_MCALL, num_params, sets_comp, AddressMode::IMMEDIATE, values[idx]);
+        }
+    }
+    for (const auto &[entry, candidate] : candidates) {
+        for (u32 idx : candidate.body) {
+            if (opcode_of(code[idx]) == T::EXIT) code[idx] = with_opcode(code[idx], T::EXT_MEXIT);
+        }
+    }
+
+    program.memoized_subroutines = u32(candidates.size());
+    return u32(candidates.size());
+}
+
+u32 Optimizer::memoize(Program &program) {
+    widen_operands(program);
+    u32 memoized = memoize_subroutines(program);
+    narrow_operands(program);
+    return memoized;
+}
+
+void Optimizer::optimize(Program &program, Options &options) {
+    widen_operands(program);
+
+    u32 promoted = promote_variables(program);
+    if (promoted > 0) {
+        std::printf("Optimizer: promoted %u variable%s to registers\n", promoted, promoted == 1 ? "" : "s");
+    }
+
+    u32 inlined = inline_subroutines(program, options.inline_threshold);
+    if (inlined > 0) {
+        std::printf("Optimizer: inlined %u subroutine call%s\n", inlined, inlined == 1 ? "" : "s");
+    }
+
+    u32 tail_calls = convert_tail_calls(program);
+    if (tail_calls > 0) {
+        std::printf("Optimizer: converted %u tail call%s\n", tail_calls, tail_calls == 1 ? "" : "s");
+    }
+
+    u32 proven = prove_memory_accesses(program, options.stack_size);
+    if (proven > 0) {
+        std::printf("Optimizer: proved %u memory access%s to be in bounds\n", proven, proven == 1 ? "" : "es");
+    }
+
+    u32 loops = recognize_loop_idioms(program);
+    if (loops > 0) {
+        std::printf("Optimizer: replaced %u array loop%s with bulk operations\n", loops, loops == 1 ? "" : "s");
+    }
+
+    narrow_operands(program);
+}
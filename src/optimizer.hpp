@@ -0,0 +1,15 @@
+#pragma once
+
+#include "program.hpp"
+#include "options.hpp"
+
+namespace Optimizer {
+    // Rewrites the bytecode of a successfully compiled program.
+    // Must be called before create_runtime().
+    void optimize(Program &program, Options &options);
+
+    // Makes calls to subroutines that only depend on their parameters go through a
+    // cache of earlier results. Returns the number of such subroutines.
+    // Must be called after optimize(), if at all.
+    u32 memoize(Program &program);
+}
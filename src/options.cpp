@@ -11,7 +11,7 @@ static void print_version() {
 }
 
 static void print_option(const char *sform, const char* lform, const char *desc) {
-    std::printf("  %-4s  %-18s   %s\n", sform, lform, desc);
+    std::printf("  %-4s  %-19s   %s\n", sform, lform, desc);
 }
 
 static void print_help() {
@@ -24,6 +24,18 @@ static void print_help() {
     print_option("-bio", "--bench-io", "Suppresses printing while benchmarking. (default: false)");
     print_option("-d", "--dry", "Compiles the file without executing.");
     print_option("-ss", "--stack-size", "Sets the stack size for the program. (1 MiB by default)");
+    print_option("", "--input", "Reads IN =KBD numbers from a file without prompting, - for stdin.");
+    print_option("", "--async-output", "Prints the output of OUT on a separate thread. (default: false)");
+    print_option("", "--output-digest", "Prints a hash of the output and the number of values instead of the output. (default: false)");
+    print_option("", "--expect", "Stops at the first OUT value that differs from the numbers in a file.");
+    print_option("", "--huge-pages", "Uses 2 MiB pages for program memory where supported. (default: false)");
+    print_option("", "--compact-data", "Lays out DC/DS variables one word apart instead of four. (default: false)");
+    print_option("-O", "--optimize", "Optimizes the bytecode before executing. (default: false)");
+    print_option("", "--inline-threshold", "Max size of subroutines inlined by -O, 0 disables. (default: 32)");
+    print_option("", "--memoize", "Caches the results of subroutines that only depend on their parameters. (default: false)");
+    print_option("", "--stats", "Prints execution statistics, such as memoization hit rates. (default: false)");
+    print_option("-p", "--precompute", "Runs programs that take no input ahead of time and saves the results. (default: false)");
+    print_option("", "--precompute-budget", "Max instructions to run ahead of time. (default: 10000000)");
     print_option("", "--help", "Shows this page.");
     print_option("-v", "--version", "Shows version information.");
 }
@@ -37,6 +49,18 @@ bool parse_options(int argc, char **argv, Options &out) {
         .add_arg("bio", "bench-io", out.bench_io)
         .add_arg("d", "dry", out.dry_run)
         .add_arg("ss", "stack-size", out.stack_size)
+        .add_arg("", "input", out.input_file, std::nullopt) // the shorter overloads are ambiguous for string_view
+        .add_arg("async-output", out.async_output)
+        .add_arg("output-digest", out.output_digest)
+        .add_arg("", "expect", out.expect_file, std::nullopt)
+        .add_arg("huge-pages", out.huge_pages)
+        .add_arg("compact-data", out.compact_data)
+        .add_arg("O", "optimize", out.optimize)
+        .add_arg("inline-threshold", out.inline_threshold)
+        .add_arg("memoize", out.memoize)
+        .add_arg("stats", out.stats)
+        .add_arg("p", "precompute", out.precompute)
+        .add_arg("precompute-budget", out.precompute_budget)
         .add_arg("help", help)
         .add_arg("v", "version", version)
         .parse(std::size_t(argc), argv);
@@ -76,6 +100,11 @@ bool parse_options(int argc, char **argv, Options &out) {
     }
     out.filename = result.remaining_args[0].data();
 
+    if (out.input_file == "-" && out.benchmark_iterations > 1) {
+        std::printf("Error: Can't benchmark with --input=-, every iteration needs the same input (use a file)\n");
+        return false;
+    }
+
     if (out.benchmark_iterations > 500'000'000) {
         std::printf("Warning: Over 500 million benchmark iterations requested (intentional? ctrl-c to abort)\n\n");
     } else if (out.benchmark_iterations == 0) out.benchmark_iterations = 1;
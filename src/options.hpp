@@ -2,14 +2,28 @@
 
 #include "types.hpp"
 
+#include <string_view>
+
 // Compiler command line options
 
 struct Options {
     u64 benchmark_iterations = 1;
     u64 stack_size = 1 << 20; // 1 MB
     const char* filename;
+    std::string_view input_file; // IN =KBD reads from this instead of asking, "-" = stdin
+    std::string_view expect_file; // what OUT should print, execution stops at the first difference
     bool bench_io = false;
+    bool async_output = false; // OUT hands its numbers to a writer thread
+    bool output_digest = false; // OUT only feeds a hash, printed at the end
     bool dry_run = false; // compilation only
+    bool huge_pages = false; // back the program's memory with 2 MiB pages when possible
+    bool compact_data = false; // DC/DS take one memory slot per word instead of four
+    bool optimize = false;
+    u32 inline_threshold = 32; // max instructions in an inlined subroutine, 0 = never inline
+    bool memoize = false; // cache the results of pure subroutines
+    bool stats = false; // print execution statistics
+    bool precompute = false; // run input-free programs ahead of time, see precompute.cpp
+    u64 precompute_budget = 10'000'000; // instructions
 };
 
 bool parse_options(int argc, char **argv, Options &out);
@@ -0,0 +1,108 @@
+#include "precompute.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+// Artifact format, all text except for the output which is stored as-is:
+//
+//   ttkic-precomputed <version>
+//   key <hash of the source and everything else the result depends on>
+//   executed <instruction count>
+//   halt <0 if the program ran off its end, 1 otherwise>
+//   registers <R0> ... <R7>
+//   output <length in bytes>
+//   <output>
+constexpr u32 ARTIFACT_VERSION = 1;
+
+static std::string artifact_path(const Options &options) {
+    return std::string{ options.filename } + ".pre";
+}
+
+static u64 artifact_key(const Program &program, const Options &options) {
+    // The stack size decides whether deep recursion overflows, the data layout whether
+    // array accesses do, and the optimizer and memoization change the instruction count,
+    // so results don't carry over when any of them change
+    u64 hash = HASH_SEED;
+    hash = hash_bytes(hash, &ARTIFACT_VERSION, sizeof(ARTIFACT_VERSION));
+    hash = hash_bytes(hash, &options.stack_size, sizeof(options.stack_size));
+    hash = hash_bytes(hash, &options.compact_data, sizeof(options.compact_data));
+    hash = hash_bytes(hash, &options.optimize, sizeof(options.optimize));
+    hash = hash_bytes(hash, &options.inline_threshold, sizeof(options.inline_threshold));
+    hash = hash_bytes(hash, &options.memoize, sizeof(options.memoize));
+    return hash_bytes(hash, &program.source_hash, sizeof(program.source_hash));
+}
+
+static bool load_artifact(const std::string &path, u64 key, Precomputation &out) {
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    if (!in) return false;
+
+    std::string tag;
+    u32 version{};
+    u64 stored_key{}, output_size{};
+    bool halted{};
+
+    in >> tag >> version;
+    if (!in || tag != "ttkic-precomputed" || version != ARTIFACT_VERSION) return false;
+
+    in >> tag >> std::hex >> stored_key >> std::dec;
+    if (!in || tag != "key" || stored_key != key) return false;
+
+    in >> tag >> out.executed_instructions;
+    if (!in || tag != "executed") return false;
+
+    in >> tag >> halted;
+    if (!in || tag != "halt") return false;
+    out.missing_halt = !halted;
+
+    in >> tag;
+    if (!in || tag != "registers") return false;
+    for (auto &reg : out.registers) in >> reg;
+
+    in >> tag >> output_size;
+    if (!in || tag != "output") return false;
+    in.get(); // newline
+
+    out.output.resize(output_size);
+    in.read(out.output.data(), std::streamsize(output_size));
+    return bool(in);
+}
+
+static bool save_artifact(const std::string &path, u64 key, const Precomputation &result) {
+    std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+
+    out << "ttkic-precomputed " << ARTIFACT_VERSION << '\n';
+    out << "key " << std::hex << key << std::dec << '\n';
+    out << "executed " << result.executed_instructions << '\n';
+    out << "halt " << !result.missing_halt << '\n';
+    out << "registers";
+    for (i32 reg : result.registers) out << ' ' << reg;
+    out << '\n';
+    out << "output " << result.output.size() << '\n';
+    out.write(result.output.data(), std::streamsize(result.output.size()));
+    return bool(out);
+}
+
+bool Precompute::run(Program &program, Options &options, Precomputation &out) {
+    auto path = artifact_path(options);
+    u64 key = artifact_key(program, options);
+
+    if (load_artifact(path, key, out)) {
+        std::printf("Using precomputed results from %s\n", path.c_str());
+        return true;
+    }
+
+    auto runtime = Runtime{};
+    if (!create_runtime(program, runtime, options) || !precompute(runtime, options, options.precompute_budget, out)) {
+        // Needs input, takes too long or errors out. Any of which the normal run handles.
+        return false;
+    }
+
+    if (save_artifact(path, key, out)) {
+        std::printf("Precomputed results saved to %s\n", path.c_str());
+    } else {
+        std::printf("Warning: Could not save precomputed results to %s\n", path.c_str());
+    }
+    return true;
+}
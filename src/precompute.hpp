@@ -0,0 +1,13 @@
+#pragma once
+
+#include "program.hpp"
+#include "options.hpp"
+#include "interpreter.hpp"
+
+namespace Precompute {
+    // Gets the result of an input-free program without executing it for real: either from
+    // the artifact an earlier run left next to the source file, or by running it ahead of
+    // time under the instruction budget (and leaving an artifact behind).
+    // Returns false if the program has to be executed normally.
+    bool run(Program &program, Options &options, Precomputation &out);
+}
@@ -1,21 +1,50 @@
 #pragma once
 
 #include <vector>
+#include <string>
 
 #include "types.hpp"
 #include "instructions.hpp"
 
+// FNV-1a; only needs to catch edits, not adversaries
+constexpr u64 HASH_SEED = 0xcbf29ce484222325ull;
+
+inline u64 hash_bytes(u64 hash, const void *data, std::size_t size) {
+    auto bytes = static_cast<const u8 *>(data);
+    for (std::size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
 struct DataConstant {
     i32 address;
     i32 value;
 };
 
+// A variable the optimizer moved out of memory into a virtual register.
+// Its value is written back to `address` when the program halts.
+struct PromotedVariable {
+    i32 address;
+    Register reg;
+};
+
 struct Program {
     std::vector<u32> instructions;
+
+    // Instructions only have room for 16-bit values. When some value (an address, an immediate
+    // or a jump target) doesn't fit, the compiler stores the full value of every instruction
+    // here and the interpreter takes its values from this instead. Empty for most programs.
+    std::vector<i32> wide_operands;
     std::vector<DataConstant> constants;
+    std::vector<i32> scalar_addresses; // addresses of single-word DC/DS variables
+    std::vector<PromotedVariable> promoted_variables; // see optimizer.cpp
+    u32 memoized_subroutines = 0; // see Optimizer::memoize()
     std::size_t data_section_bytes;
 
-    std::string source_code;
-    std::vector<std::string_view> source_code_lines;
-    std::vector<u32> instr_idx_to_line_idx; // see interpreter.cpp
+    // Debug info. The source is only needed for error messages, so it isn't kept around but
+    // read again from the file when an error happens (see print_faulty_instruction()).
+    std::string source_file;
+    u64 source_hash; // of the source as compiled, to notice if the file has changed since
+    std::vector<u32> instr_idx_to_line_idx;
 };
@@ -0,0 +1,39 @@
+#include "runtime_pool.hpp"
+
+RuntimePool::RuntimePool(std::size_t capacity) : capacity(capacity) {
+    // release() shouldn't have to allocate either
+    runtimes.reserve(capacity);
+}
+
+bool RuntimePool::acquire(Program &program, Runtime &out, Options &options) {
+    pool_stats.acquired += 1;
+
+    // The smallest memory that fits leaves the larger ones to larger programs. The newest wins ties.
+    std::size_t num_words = runtime_memory_words(program, options);
+    std::size_t best = runtimes.size();
+    for (std::size_t i = runtimes.size(); i-- > 0;) {
+        const Memory &memory = runtimes[i].memory;
+        if (memory.capacity() < num_words) continue;
+        if (options.huge_pages && !memory.uses_huge_pages()) continue;
+        if (best == runtimes.size() || memory.capacity() < runtimes[best].memory.capacity()) best = i;
+    }
+
+    if (best == runtimes.size()) return create_runtime(program, out, options);
+
+    out = std::move(runtimes[best]);
+    runtimes.erase(runtimes.begin() + std::ptrdiff_t(best));
+
+    pool_stats.hits += 1;
+    pool_stats.bytes_recycled += num_words * sizeof(i32);
+    return reuse_runtime(program, out, options);
+}
+
+void RuntimePool::release(Runtime &&runtime) {
+    if (capacity == 0 || runtime.memory.size() == 0) return;
+
+    runtime.memory.zero();
+    if (runtimes.size() == capacity) {
+        runtimes.erase(runtimes.begin());
+    }
+    runtimes.push_back(std::move(runtime));
+}
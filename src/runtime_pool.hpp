@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+
+#include "types.hpp"
+#include "program.hpp"
+#include "options.hpp"
+#include "interpreter.hpp"
+
+// Keeps the runtimes of finished executions around for later ones, for running many
+// programs in one process. A runtime is reused when its memory has room for what the next
+// program needs. Memory is allocated in size classes, so programs with the same stack
+// size and similar data sections share it. Once the pool is warm, getting a runtime
+// allocates nothing.
+class RuntimePool {
+public:
+    struct Stats {
+        u64 acquired;
+        u64 hits;           // acquisitions served by a pooled runtime
+        u64 bytes_recycled; // memory that didn't have to be allocated again
+    };
+
+    explicit RuntimePool(std::size_t capacity = 8);
+
+    // Same as create_runtime(), but takes a pooled runtime if one fits
+    bool acquire(Program &program, Runtime &out, Options &options);
+
+    // Hands a runtime back once it's done executing. Resets the memory it used right away,
+    // so the next acquire() doesn't have to. When the pool is full, the oldest runtime goes.
+    void release(Runtime &&runtime);
+
+    const Stats &stats() const { return pool_stats; }
+
+private:
+    std::vector<Runtime> runtimes; // oldest first
+    std::size_t capacity;
+    Stats pool_stats{};
+};